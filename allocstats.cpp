@@ -0,0 +1,164 @@
+// Heap accounting per phase, for the allocation profiling build.
+
+#include "allocstats.h"
+
+#ifdef INIREADER_ALLOC_STATS
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#endif
+
+using namespace std;
+
+#ifdef INIREADER_ALLOC_STATS
+
+namespace {
+
+struct PhaseCounters {
+    atomic<uint64_t> allocations {0};
+    atomic<uint64_t> frees {0};
+    atomic<uint64_t> bytes {0};
+    atomic<uint64_t> live {0};
+    atomic<uint64_t> peak_live {0};
+};
+
+PhaseCounters                counters[alloc_phases];
+thread_local AllocPhase      current = AllocPhase::Other;
+
+// Kept just before every block handed out, so delete knows what to undo
+struct Header {
+    uint64_t size;
+    uint32_t phase;
+    uint32_t offset; // from the start of the underlying allocation
+};
+
+constexpr size_t header_space = alignof(max_align_t);
+static_assert(sizeof(Header) <= header_space);
+
+void* allocate(size_t n, size_t align) noexcept {
+    const size_t offset = max(header_space, align);
+    void*        base   = align > header_space ? aligned_alloc(align, (n + offset + align - 1) / align * align)
+                                               : malloc(n + offset);
+    if (!base) {
+        return nullptr;
+    }
+
+    char*   p = static_cast<char*>(base) + offset;
+    Header* h = reinterpret_cast<Header*>(p) - 1;
+    *h        = Header { n, static_cast<uint32_t>(current), static_cast<uint32_t>(offset) };
+
+    PhaseCounters& c = counters[h->phase];
+    c.allocations.fetch_add(1, memory_order_relaxed);
+    c.bytes.fetch_add(n, memory_order_relaxed);
+    uint64_t live = c.live.fetch_add(n, memory_order_relaxed) + n;
+    uint64_t peak = c.peak_live.load(memory_order_relaxed);
+    while (live > peak && !c.peak_live.compare_exchange_weak(peak, live, memory_order_relaxed)) {
+    }
+    return p;
+}
+
+void release(void* p) noexcept {
+    if (!p) {
+        return;
+    }
+    Header*        h = static_cast<Header*>(p) - 1;
+    PhaseCounters& c = counters[h->phase];
+    c.frees.fetch_add(1, memory_order_relaxed);
+    c.live.fetch_sub(h->size, memory_order_relaxed);
+    free(static_cast<char*>(p) - h->offset);
+}
+
+void* allocate_or_throw(size_t n, size_t align) {
+    void* p = allocate(n, align);
+    if (!p) {
+        throw bad_alloc();
+    }
+    return p;
+}
+
+} // namespace
+
+AllocScope::AllocScope(AllocPhase phase) noexcept
+    : previous(current) {
+    current = phase;
+}
+
+AllocScope::~AllocScope() {
+    current = previous;
+}
+
+AllocCounts alloc_counts(AllocPhase phase) noexcept {
+    const PhaseCounters& c = counters[static_cast<size_t>(phase)];
+    return AllocCounts { c.allocations.load(memory_order_relaxed), c.frees.load(memory_order_relaxed),
+                         c.bytes.load(memory_order_relaxed), c.peak_live.load(memory_order_relaxed) };
+}
+
+void* operator new(size_t n) {
+    return allocate_or_throw(n, header_space);
+}
+
+void* operator new[](size_t n) {
+    return allocate_or_throw(n, header_space);
+}
+
+void* operator new(size_t n, align_val_t align) {
+    return allocate_or_throw(n, static_cast<size_t>(align));
+}
+
+void* operator new[](size_t n, align_val_t align) {
+    return allocate_or_throw(n, static_cast<size_t>(align));
+}
+
+void* operator new(size_t n, const nothrow_t&) noexcept {
+    return allocate(n, header_space);
+}
+
+void* operator new[](size_t n, const nothrow_t&) noexcept {
+    return allocate(n, header_space);
+}
+
+void* operator new(size_t n, align_val_t align, const nothrow_t&) noexcept {
+    return allocate(n, static_cast<size_t>(align));
+}
+
+void* operator new[](size_t n, align_val_t align, const nothrow_t&) noexcept {
+    return allocate(n, static_cast<size_t>(align));
+}
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+void operator delete(void* p, align_val_t) noexcept { release(p); }
+void operator delete[](void* p, align_val_t) noexcept { release(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { release(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { release(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { release(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { release(p); }
+
+#else
+
+AllocCounts alloc_counts(AllocPhase) noexcept {
+    return {};
+}
+
+#endif
+
+const char* phase_name(AllocPhase phase) noexcept {
+    switch (phase) {
+    case AllocPhase::Other:
+        return "other";
+    case AllocPhase::Reading:
+        return "reading";
+    case AllocPhase::Trimming:
+        return "trimming";
+    case AllocPhase::Parsing:
+        return "parsing";
+    case AllocPhase::Lookup:
+        return "lookup";
+    }
+    return "?";
+}
@@ -0,0 +1,65 @@
+// Heap accounting per phase, for the allocation profiling build.
+//
+// Built with INIREADER_ALLOC_STATS defined (cmake -DINIREADER_ALLOC_STATS=ON
+// or make ALLOC_STATS=1), the global operator new and delete are replaced
+// by versions that count allocations, bytes and peak live bytes against the
+// phase the calling thread is in. Code marks its phases with AllocScope;
+// scopes nest, and the innermost one wins, so the trim() inside a parse is
+// charged to trimming. In a normal build AllocScope is an empty object and
+// nothing is counted.
+//
+// inireader --stats prints the counts after a lookup, and the makefile's
+// test target asserts that the line primitives in ini.h stay free of
+// allocations.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class AllocPhase : uint8_t {
+    Other,
+    Reading,  // getting bytes from the file
+    Trimming, // trim() and unquote()
+    Parsing,  // telling headers and entries apart and splitting them
+    Lookup,   // finding the key once the text is parsed
+};
+
+constexpr size_t alloc_phases = 5;
+
+#ifdef INIREADER_ALLOC_STATS
+constexpr bool alloc_stats_built = true;
+#else
+constexpr bool alloc_stats_built = false;
+#endif
+
+struct AllocCounts {
+    uint64_t allocations = 0;
+    uint64_t frees       = 0; // of blocks allocated in the phase
+    uint64_t bytes       = 0; // allocated in total
+    uint64_t peak_live   = 0; // most bytes allocated in the phase alive at once
+};
+
+// Counts for phase so far; all zero unless alloc_stats_built
+[[nodiscard]] AllocCounts alloc_counts(AllocPhase phase) noexcept;
+
+[[nodiscard]] const char* phase_name(AllocPhase phase) noexcept;
+
+// Charges the calling thread's allocations to phase until destroyed
+class AllocScope {
+public:
+#ifdef INIREADER_ALLOC_STATS
+    explicit AllocScope(AllocPhase phase) noexcept;
+    ~AllocScope();
+#else
+    explicit AllocScope(AllocPhase) noexcept { }
+#endif
+
+    AllocScope(const AllocScope&)            = delete;
+    AllocScope& operator=(const AllocScope&) = delete;
+
+#ifdef INIREADER_ALLOC_STATS
+private:
+    AllocPhase previous;
+#endif
+};
@@ -0,0 +1,318 @@
+// Batched reads of many whole files, handed to parser workers.
+
+#include "batchread.h"
+
+#include "scheduler.h"
+#include "uring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned ring_entries = 256;
+constexpr size_t   window       = 64;        // files in flight on the ring
+constexpr size_t   unsized_read = 64 * 1024; // first read of a file without a size
+constexpr size_t   max_read     = 0x7ffff000; // the most one read returns on Linux
+
+// Hands each file to consume() in a task of its own
+class Workers {
+public:
+    Workers(Scheduler& pool, const FileConsumer& consume)
+        : pool(pool)
+        , consume(consume) { }
+
+    void push(size_t index, string text, int error) {
+        pool.submit([this, index, text = std::move(text), error]() mutable { consume(index, text, error); });
+    }
+
+private:
+    Scheduler&          pool;
+    const FileConsumer& consume;
+};
+
+// Read from fd at offset until the end, growing text when it is full;
+// returns 0 or an errno. Pipes, which cannot be read at an offset, are
+// read from where they are.
+int read_rest(int fd, string& text, size_t offset) {
+    bool seekable = true;
+    while (true) {
+        if (offset == text.size()) {
+            text.resize(max(text.size() * 2, offset + unsized_read));
+        }
+        ssize_t n = seekable ? ::pread(fd, text.data() + offset, text.size() - offset, static_cast<off_t>(offset))
+                             : ::read(fd, text.data() + offset, text.size() - offset);
+        if (n < 0 && (errno == EINTR || (errno == ESPIPE && seekable))) {
+            seekable = errno == EINTR && seekable;
+            continue;
+        }
+        if (n <= 0) {
+            text.resize(offset);
+            return n < 0 ? errno : 0;
+        }
+        offset += static_cast<size_t>(n);
+    }
+}
+
+// The synchronous path: open, fstat, read and close; returns 0 or an errno
+int read_file(const filesystem::path& path, string& text) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    struct stat st;
+    int         error = 0;
+    if (::fstat(fd, &st) != 0) {
+        error = errno;
+    } else if (st.st_size > 0) {
+        // A regular file is read whole by one read of a byte more than its
+        // size, unless it grew or is larger than one read returns
+        const size_t size = static_cast<size_t>(st.st_size);
+        text.resize(size + 1);
+        ssize_t n = ::read(fd, text.data(), text.size());
+        if (n < 0) {
+            error = errno;
+            text.clear();
+        } else if (n > 0 && (static_cast<size_t>(n) == text.size() || static_cast<size_t>(n) < size)) {
+            error = read_rest(fd, text, static_cast<size_t>(n));
+        } else {
+            text.resize(static_cast<size_t>(n));
+        }
+    } else {
+        error = read_rest(fd, text, 0);
+    }
+    ::close(fd);
+    return error;
+}
+
+void read_one_by_one(const vector<filesystem::path>& paths, size_t from, Workers& workers, BatchStats& stats) {
+    for (size_t i = from; i < paths.size(); ++i) {
+        string text;
+        int    error = read_file(paths[i], text);
+        stats.failed += error != 0;
+        stats.bytes += text.size();
+        workers.push(i, std::move(text), error);
+    }
+}
+
+enum Op : uint64_t { Open, Stat, Read, Close };
+
+uint64_t tag(size_t index, Op op) {
+    return static_cast<uint64_t>(index) << 2 | op;
+}
+
+struct InFlight {
+    int          fd      = -1; // until its close completes
+    int          error   = 0;
+    int          waiting = 0; // of the open and the statx
+    bool         handed  = false;
+    struct statx st;
+    string       text;
+};
+
+// The io_uring path; false if the ring failed before any file was started.
+// files is the caller's so that it outlives the ring, which may still be
+// writing into it when a failure cuts the path short.
+bool read_on_ring(Uring& ring, vector<InFlight>& files, const vector<filesystem::path>& paths, Workers& workers,
+                  BatchStats& stats) {
+    files.resize(paths.size());
+    size_t next    = 0; // first file not started
+    size_t active  = 0; // started and not handed on
+    size_t closing = 0; // closes not yet completed
+    size_t pending = 0; // operations queued and not yet reaped
+
+    // A full queue only needs submitting to make room; false if it stays
+    // full
+    auto queue = [&](const auto& prepare) {
+        const bool queued = prepare() || (ring.submit(0) && prepare());
+        pending += queued;
+        return queued;
+    };
+
+    auto hand_on = [&](size_t i) {
+        InFlight& f = files[i];
+        if (f.error == EINVAL) {
+            // Kernels before 5.6 do not know the open and statx operations
+            f.text.clear();
+            f.error = read_file(paths[i], f.text);
+        }
+        if (f.fd >= 0) {
+            if (queue([&] { return ring.prepare_close(f.fd, tag(i, Close)); })) {
+                ++closing;
+            } else {
+                ::close(f.fd);
+                f.fd = -1;
+            }
+        }
+        stats.failed += f.error != 0;
+        stats.bytes += f.text.size();
+        f.handed = true;
+        workers.push(i, std::move(f.text), f.error);
+        --active;
+    };
+
+    auto start_read = [&](size_t i) {
+        InFlight& f = files[i];
+        if (f.error) {
+            hand_on(i);
+            return;
+        }
+        if (!S_ISREG(f.st.stx_mode)) {
+            f.error = read_rest(f.fd, f.text, 0); // pipes and devices
+            hand_on(i);
+            return;
+        }
+        // One byte more than the size shows that the file grew; files that
+        // report no size, like those in procfs, are read on to the end, and
+        // so are files larger than one read returns
+        const size_t size = static_cast<size_t>(f.st.stx_size);
+        f.text.resize(size > 0 ? size + 1 : unsized_read);
+        const auto len = static_cast<unsigned>(min(f.text.size(), max_read));
+        if (!queue([&] { return ring.prepare_read(f.fd, f.text.data(), len, 0, tag(i, Read)); })) {
+            f.error = read_rest(f.fd, f.text, 0);
+            hand_on(i);
+        }
+    };
+
+    auto finish_read = [&](size_t i, int res) {
+        InFlight& f = files[i];
+        if (res < 0) {
+            f.error = -res;
+            f.text.clear();
+        } else if (res > 0 && (static_cast<size_t>(res) == f.text.size() || static_cast<uint64_t>(res) < f.st.stx_size
+                               || f.st.stx_size == 0)) {
+            f.error = read_rest(f.fd, f.text, static_cast<size_t>(res));
+        } else {
+            f.text.resize(static_cast<size_t>(res));
+        }
+        hand_on(i);
+    };
+
+    // After a failed submit: take back what never reached the kernel, wait
+    // for the rest as far as the ring lets us, and close every file it
+    // opened. A file handed on still has its descriptor only while its
+    // close is in flight.
+    auto abandon = [&] {
+        uint64_t id;
+        int      res;
+        while (ring.withdraw(id)) {
+            --pending;
+            InFlight& f = files[static_cast<size_t>(id >> 2)];
+            if (static_cast<Op>(id & 3) == Close) {
+                ::close(f.fd);
+                f.fd = -1;
+            }
+        }
+        while (pending > 0) {
+            if (!ring.reap(id, res)) {
+                if (!ring.submit(1)) {
+                    break;
+                }
+                continue;
+            }
+            --pending;
+            InFlight& f = files[static_cast<size_t>(id >> 2)];
+            if (static_cast<Op>(id & 3) == Open && res >= 0) {
+                f.fd = res;
+            } else if (static_cast<Op>(id & 3) == Close) {
+                f.fd = -1;
+            }
+        }
+        for (InFlight& f : files) {
+            if (f.fd >= 0 && !f.handed) {
+                ::close(f.fd);
+                f.fd = -1;
+            }
+        }
+    };
+
+    while (next < paths.size() || active > 0 || closing > 0) {
+        while (active < window && next < paths.size() && ring.space() >= 2) {
+            InFlight& f = files[next];
+            f.waiting   = 2;
+            ring.prepare_openat(paths[next].c_str(), O_RDONLY | O_CLOEXEC, tag(next, Open));
+            ring.prepare_statx(paths[next].c_str(), STATX_TYPE | STATX_SIZE, &f.st, tag(next, Stat));
+            pending += 2;
+            ++next;
+            ++active;
+        }
+        if (!ring.submit(1)) {
+            abandon();
+            if (next == active) {
+                return false;
+            }
+            // The files the ring had not finished are read again into fresh
+            // buffers
+            for (size_t i = 0; i < next; ++i) {
+                if (!files[i].handed) {
+                    string text;
+                    int    error = read_file(paths[i], text);
+                    stats.failed += error != 0;
+                    stats.bytes += text.size();
+                    workers.push(i, std::move(text), error);
+                }
+            }
+            read_one_by_one(paths, next, workers, stats);
+            return true;
+        }
+
+        uint64_t id;
+        int      res;
+        while (ring.reap(id, res)) {
+            --pending;
+            const size_t i = static_cast<size_t>(id >> 2);
+            InFlight&    f = files[i];
+            switch (static_cast<Op>(id & 3)) {
+            case Open:
+                if (res < 0) {
+                    f.error = -res;
+                } else {
+                    f.fd = res;
+                }
+                if (--f.waiting == 0) {
+                    start_read(i);
+                }
+                break;
+            case Stat:
+                if (res < 0 && !f.error) {
+                    f.error = -res;
+                }
+                if (--f.waiting == 0) {
+                    start_read(i);
+                }
+                break;
+            case Read:
+                finish_read(i, res);
+                break;
+            case Close:
+                f.fd = -1;
+                --closing;
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+BatchStats read_files(const vector<filesystem::path>& paths, Scheduler& pool, bool use_uring,
+                      const FileConsumer& consume) {
+    BatchStats stats;
+    stats.files = paths.size();
+    Workers          workers(pool, consume);
+    vector<InFlight> files; // declared first, so the ring goes before it
+    Uring            ring;
+    if (use_uring && !paths.empty() && ring.init(ring_entries) && read_on_ring(ring, files, paths, workers, stats)) {
+        stats.uring = true;
+    } else {
+        read_one_by_one(paths, 0, workers, stats);
+    }
+    pool.wait();
+    return stats;
+}
@@ -0,0 +1,45 @@
+// Batched reads of many whole files, handed to parser workers.
+//
+// Answering one query across thousands of small files is dominated by the
+// open, stat, read and close calls for each of them, not by parsing.
+// read_files() keeps a window of files in flight on an io_uring ring (see
+// uring.h): the open and statx of each file are submitted together, the
+// read once both have completed, and the close after the read, so a single
+// io_uring_enter(2) serves many files at once. Every file read becomes a
+// task on a Scheduler (see scheduler.h) that runs consume() on it while
+// the ring goes on reading the next ones; the consumer may split a large
+// file into further tasks on the same scheduler.
+//
+// Where io_uring is missing or forbidden, or when asked to, the files are
+// read with plain system calls one after the other, and the workers are
+// fed the same way.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+class Scheduler;
+
+struct BatchStats {
+    size_t   files  = 0; // handed to consume()
+    size_t   failed = 0; // of those, could not be read
+    uint64_t bytes  = 0;
+    bool     uring  = false; // read through io_uring rather than one by one
+};
+
+// Called once per file, from a task on the scheduler, with its index in
+// paths and its contents, which it may take, or with error set to an errno
+// value if it could not be read
+using FileConsumer = std::function<void(size_t index, std::string& text, int error)>;
+
+// Read every file in paths and pass it to consume() in a task on pool; a
+// pool without workers runs consume() on the calling thread. io_uring is
+// used unless use_uring is false or it is unavailable. Returns when every
+// file has been consumed, along with every task consume() spawned.
+BatchStats read_files(const std::vector<std::filesystem::path>& paths, Scheduler& pool, bool use_uring,
+                      const FileConsumer& consume);
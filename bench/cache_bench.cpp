@@ -0,0 +1,301 @@
+// Cold and warm page cache lookups for each way of reading the file.
+//
+// usage: cache_bench [iterations] [ini-file]
+//
+// Times a streaming lookup of a key in the last section of the file, so
+// that every byte is read, through each I/O strategy:
+//
+//     ifstream     getline over an ifstream, like --io=stream
+//     read         read(2) in 64 KiB blocks, split into lines in place
+//     mmap         a read-only mapping scanned in place
+//     mmap+seq     the same with madvise(MADV_SEQUENTIAL) for readahead
+//     direct       LineReader's O_DIRECT backend (see linereader.h)
+//     uring        LineReader's io_uring backend
+//     pipeline     LineReader's I/O thread reading ahead of the scan
+//     auto         whichever backend LineReader chooses for the file
+//
+// Before each cold run the file is evicted from the page cache with
+// posix_fadvise(POSIX_FADV_DONTNEED), and mincore() checks that it is
+// gone; warm runs follow a run that left the whole file cached. Each mode
+// runs the given number of times (default 5) and reports the best and the
+// median time and the median throughput.
+//
+// Without a file a config of a million entries (about 23 MB) is generated
+// under /var/tmp. Eviction needs a file system with a page cache: on tmpfs
+// the file cannot be evicted, which the benchmark reports rather than
+// passing warm numbers off as cold ones.
+
+#include "ini.h"
+#include "linereader.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+constexpr size_t block_size = 64 * 1024;
+
+// Section and key of the last entry in the file, the costliest to find
+pair<string, string> last_entry(const string& path) {
+    ifstream             file(path);
+    string               line;
+    pair<string, string> last;
+    string               section;
+    Entry                entry;
+    while (getline(file, line)) {
+        string_view trimmed = trim(line);
+        if (is_header(trimmed)) {
+            section = header_name(trimmed);
+        } else if (!is_ignorable(trimmed) && parse_section_entry(trimmed, entry) && entry.valid()) {
+            last = {section, string(entry.name())};
+        }
+    }
+    return last;
+}
+
+// Fraction of the file's pages in the page cache
+double cached_fraction(const string& path) {
+    int         fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return 0;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void*        map  = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    const size_t          page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    vector<unsigned char> resident((size + page - 1) / page);
+    size_t                cached = 0;
+    if (::mincore(map, size, resident.data()) == 0) {
+        cached = static_cast<size_t>(count_if(resident.begin(), resident.end(), [](unsigned char r) { return r & 1; }));
+    }
+    ::munmap(map, size);
+    return resident.empty() ? 0 : static_cast<double>(cached) / static_cast<double>(resident.size());
+}
+
+// Drop the file's pages from the page cache
+void evict(const string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fdatasync(fd); // dirty pages are not dropped
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+}
+
+bool lookup_ifstream(const string& path, string_view section, string_view key) {
+    ifstream file(path);
+    string   text;
+    return scan(
+               [&](string_view& line) {
+                   if (!getline(file, text)) {
+                       return false;
+                   }
+                   line = text;
+                   return true;
+               },
+               section, key)
+        .has_value();
+}
+
+bool lookup_read(const string& path, string_view section, string_view key) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    // Lines are handed out of buf; a partial last line moves to the front
+    // before the next block is read behind it
+    vector<char> buf(2 * block_size);
+    size_t       begin = 0;
+    size_t       end   = 0;
+    bool         eof   = false;
+    auto         found = scan(
+        [&](string_view& line) {
+            while (true) {
+                string_view pending(buf.data() + begin, end - begin);
+                size_t      eol = pending.find('\n');
+                if (eol != string_view::npos || (eof && !pending.empty())) {
+                    line = pending.substr(0, eol);
+                    begin += eol == string_view::npos ? pending.size() : eol + 1;
+                    return true;
+                }
+                if (eof) {
+                    return false;
+                }
+                copy(buf.begin() + static_cast<ptrdiff_t>(begin), buf.begin() + static_cast<ptrdiff_t>(end),
+                     buf.begin());
+                end -= begin;
+                begin = 0;
+                if (buf.size() - end < block_size) {
+                    buf.resize(buf.size() * 2);
+                }
+                ssize_t n = ::read(fd, buf.data() + end, block_size);
+                if (n <= 0) {
+                    eof = true;
+                } else {
+                    end += static_cast<size_t>(n);
+                }
+            }
+        },
+        section, key);
+    ::close(fd);
+    return found.has_value();
+}
+
+bool lookup_mmap(const string& path, string_view section, string_view key, bool sequential) {
+    int         fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void*        map  = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    if (sequential) {
+        ::madvise(map, size, MADV_SEQUENTIAL);
+    }
+    string_view rest(static_cast<const char*>(map), size);
+    auto        found = scan(
+        [&](string_view& line) {
+            if (rest.empty()) {
+                return false;
+            }
+            size_t eol = rest.find('\n');
+            line       = rest.substr(0, eol);
+            rest.remove_prefix(eol == string_view::npos ? rest.size() : eol + 1);
+            return true;
+        },
+        section, key);
+    ::munmap(map, size);
+    return found.has_value();
+}
+
+bool lookup_reader(const string& path, string_view section, string_view key, IoBackend backend) {
+    LineReader reader;
+    if (!reader.open(path, backend)) {
+        return false;
+    }
+    return scan([&](string_view& line) { return reader.next(line); }, section, key).has_value();
+}
+
+struct Strategy {
+    const char*                                             name;
+    function<bool(const string&, string_view, string_view)> lookup;
+};
+
+void report(const char* strategy, const char* mode, vector<double>& ms, double megabytes) {
+    sort(ms.begin(), ms.end());
+    const double median = ms[ms.size() / 2];
+    printf("%-10s %-6s %10.2f %10.2f %10.1f\n", strategy, mode, ms.front(), median, megabytes / (median / 1000.0));
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const int iterations = argc > 1 ? max(1, atoi(argv[1])) : 5;
+
+    string path;
+    char   dir[] = "/var/tmp/cache_bench.XXXXXX";
+    if (argc > 2) {
+        path = argv[2];
+    } else {
+        if (!::mkdtemp(dir)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        path = string(dir) + "/config.ini";
+        if (!write_config(path, 1000000)) {
+            perror("write");
+            return 1;
+        }
+    }
+
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        perror(path.c_str());
+        return 1;
+    }
+    const double megabytes    = static_cast<double>(st.st_size) / (1024.0 * 1024.0);
+    const auto [section, key] = last_entry(path);
+
+    evict(path);
+    const double left_cached = cached_fraction(path);
+    printf("%s: %.1f MiB, looking up [%s] %s, %d runs per mode\n", path.c_str(), megabytes, section.c_str(),
+           key.c_str(), iterations);
+    if (left_cached > 0.01) {
+        printf("warning: %.0f%% of the file stays cached after eviction; cold runs are not cold\n",
+               left_cached * 100.0);
+    }
+    printf("%-10s %-6s %10s %10s %10s\n", "strategy", "cache", "best ms", "median ms", "MiB/s");
+
+    const Strategy strategies[] = {
+        {"ifstream", lookup_ifstream},
+        {"read", lookup_read},
+        {"mmap", [](const string& p, string_view s, string_view k) { return lookup_mmap(p, s, k, false); }},
+        {"mmap+seq", [](const string& p, string_view s, string_view k) { return lookup_mmap(p, s, k, true); }},
+        {"direct",
+         [](const string& p, string_view s, string_view k) { return lookup_reader(p, s, k, IoBackend::Direct); }},
+        {"uring",
+         [](const string& p, string_view s, string_view k) { return lookup_reader(p, s, k, IoBackend::Uring); }},
+        {"pipeline",
+         [](const string& p, string_view s, string_view k) { return lookup_reader(p, s, k, IoBackend::Pipeline); }},
+        {"auto", [](const string& p, string_view s, string_view k) { return lookup_reader(p, s, k, IoBackend::Auto); }},
+    };
+
+    int status = 0;
+    for (const Strategy& strategy : strategies) {
+        for (bool cold : {true, false}) {
+            vector<double> ms;
+            if (!cold) {
+                strategy.lookup(path, section, key); // leaves the file cached
+            }
+            for (int i = 0; i < iterations; ++i) {
+                if (cold) {
+                    evict(path);
+                }
+                const auto start = Clock::now();
+                if (!strategy.lookup(path, section, key)) {
+                    printf("%-10s lookup failed\n", strategy.name);
+                    status = 1;
+                }
+                ms.push_back(chrono::duration<double, milli>(Clock::now() - start).count());
+            }
+            report(strategy.name, cold ? "cold" : "warm", ms, megabytes);
+        }
+    }
+
+    if (argc <= 2) {
+        ::unlink(path.c_str());
+        ::rmdir(dir);
+    }
+    return status;
+}
@@ -0,0 +1,238 @@
+// Peak and steady-state memory of each lookup engine.
+//
+// usage: memory_bench [max-entries] [lookups]
+//
+// Generates configs of 1000 entries and ten times more at each step up to
+// max-entries (default 1000000), eight keys to a section, and measures each
+// engine on each of them in a process of its own:
+//
+//     stream    the command line's default scan, getline over an ifstream
+//     mmap      the same scan over a read-only mapping of the file
+//     document  Document::load, everything parsed up front
+//     lazy      LazyDocument with no budget, sections parsed on first use
+//     tail      TailScanner, the --tail path
+//
+// The engine is set up and then performs the given number of lookups
+// (default 100) of keys spread over the file. Peak is the high-water mark
+// of the resident set over that time and steady is what is still resident
+// at the end, with the engine alive; both are relative to the process
+// before it started, and are also given in bytes per entry, which is the
+// figure to size a host class by. Memory the allocator keeps after a free
+// counts as resident, as it does in production.
+
+#include "document.h"
+#include "ini.h"
+#include "lazydoc.h"
+#include "tailscan.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Footprint {
+    uint64_t peak   = 0;
+    uint64_t steady = 0;
+};
+
+// A field of /proc/self/status, such as "VmRSS:", in bytes
+uint64_t status_bytes(const char* field) {
+    ifstream status("/proc/self/status");
+    string   line;
+    size_t   n = strlen(field);
+    while (getline(status, line)) {
+        if (line.compare(0, n, field) == 0) {
+            return strtoull(line.c_str() + n, nullptr, 10) * 1024;
+        }
+    }
+    return 0;
+}
+
+// Start the VmHWM high-water mark again from the current resident set
+void reset_peak() {
+    int fd = ::open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        [[maybe_unused]] ssize_t n = ::write(fd, "5", 1);
+        ::close(fd);
+    }
+}
+
+// Set up engine on path and perform the lookups; returns the total length
+// of the values found, or -1 if the engine could not be set up
+int64_t run_engine(const string& engine, const string& path, const vector<pair<string, string>>& lookups) {
+    int64_t total = 0;
+    auto    add   = [&](const auto& value) {
+        if (value) {
+            total += static_cast<int64_t>(value->size());
+        }
+    };
+
+    if (engine == "stream") {
+        for (const auto& [section, key] : lookups) {
+            ifstream file(path);
+            string   text;
+            add(scan(
+                [&](string_view& line) {
+                    if (!getline(file, text)) {
+                        return false;
+                    }
+                    line = text;
+                    return true;
+                },
+                section, key));
+        }
+    } else if (engine == "mmap") {
+        int         fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || ::fstat(fd, &st) != 0) {
+            return -1;
+        }
+        size_t size = static_cast<size_t>(st.st_size);
+        void*  map  = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED) {
+            return -1;
+        }
+        string_view text(static_cast<const char*>(map), size);
+        for (const auto& [section, key] : lookups) {
+            string_view rest = text;
+            add(scan(
+                [&](string_view& line) {
+                    if (rest.empty()) {
+                        return false;
+                    }
+                    size_t eol = rest.find('\n');
+                    line       = rest.substr(0, eol);
+                    rest.remove_prefix(eol == string_view::npos ? rest.size() : eol + 1);
+                    return true;
+                },
+                section, key));
+        }
+        // Left mapped: the pages it keeps resident are its steady state
+    } else if (engine == "document") {
+        static Document doc;
+        if (!doc.load(path)) {
+            return -1;
+        }
+        for (const auto& [section, key] : lookups) {
+            add(doc.get(section, key));
+        }
+    } else if (engine == "lazy") {
+        static LazyDocument doc;
+        if (!doc.open(path)) {
+            return -1;
+        }
+        for (const auto& [section, key] : lookups) {
+            add(doc.get(section, key));
+        }
+    } else if (engine == "tail") {
+        static TailScanner scanner;
+        if (!scanner.open(path)) {
+            return -1;
+        }
+        for (const auto& [section, key] : lookups) {
+            add(scanner.find_last(section, key));
+        }
+    } else {
+        return -1;
+    }
+    return total;
+}
+
+// Measure one engine in a child process, so engines do not share a heap
+optional<Footprint> measure(const string& engine, const string& path, const vector<pair<string, string>>& lookups) {
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        return nullopt;
+    }
+    pid_t child = ::fork();
+    if (child == 0) {
+        ::close(fds[0]);
+        reset_peak();
+        const uint64_t base = status_bytes("VmRSS:");
+        Footprint      result;
+        if (run_engine(engine, path, lookups) >= 0) {
+            const uint64_t peak = status_bytes("VmHWM:");
+            const uint64_t rss  = status_bytes("VmRSS:");
+            result.peak         = peak - min(base, peak);
+            result.steady       = rss - min(base, rss);
+            [[maybe_unused]] ssize_t n = ::write(fds[1], &result, sizeof(result));
+        }
+        _exit(0);
+    }
+    ::close(fds[1]);
+    Footprint result;
+    ssize_t   n = child > 0 ? ::read(fds[0], &result, sizeof(result)) : -1;
+    ::close(fds[0]);
+    if (child > 0) {
+        ::waitpid(child, nullptr, 0);
+    }
+    return n == sizeof(result) ? optional(result) : nullopt;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const int max_entries = argc > 1 ? max(1000, atoi(argv[1])) : 1000000;
+    const int lookups     = argc > 2 ? max(1, atoi(argv[2])) : 100;
+
+    char dir[] = "/tmp/memory_bench.XXXXXX";
+    if (!::mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const string path = string(dir) + "/config.ini";
+
+    printf("%d lookups per engine; RSS in KiB\n", lookups);
+    printf("%-9s %-9s %12s %12s %12s %10s %10s\n", "entries", "engine", "file KiB", "peak", "steady", "peak B/e",
+           "steady B/e");
+
+    const char* engines[] = {"stream", "mmap", "document", "lazy", "tail"};
+    for (int entries = 1000; entries <= max_entries; entries *= 10) {
+        if (!write_config(path, entries)) {
+            perror("write");
+            break;
+        }
+        struct stat st;
+        ::stat(path.c_str(), &st);
+
+        vector<pair<string, string>> keys;
+        const int                    sections = (entries + keys_in_section - 1) / keys_in_section;
+        for (int i = 0; i < lookups; ++i) {
+            int section = static_cast<int>(static_cast<int64_t>(i) * 7919 % sections);
+            keys.emplace_back("section" + to_string(section), "key" + to_string(i % keys_in_section));
+        }
+
+        for (const char* engine : engines) {
+            auto f = measure(engine, path, keys);
+            if (!f) {
+                printf("%-9d %-9s failed\n", entries, engine);
+                continue;
+            }
+            printf("%-9d %-9s %12lld %12llu %12llu %10.1f %10.1f\n", entries, engine,
+                   static_cast<long long>(st.st_size) / 1024, static_cast<unsigned long long>(f->peak / 1024),
+                   static_cast<unsigned long long>(f->steady / 1024), static_cast<double>(f->peak) / entries,
+                   static_cast<double>(f->steady) / entries);
+        }
+    }
+
+    ::unlink(path.c_str());
+    ::rmdir(dir);
+    return 0;
+}
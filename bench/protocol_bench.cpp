@@ -0,0 +1,164 @@
+// Microbenchmark for the lookup server's request and response encodings.
+//
+// usage: protocol_bench [batch-size] [seconds-per-case]
+//
+// Times encoding and decoding batches of lookups (default 32 per batch) in
+// the text protocol and in binary frames, and reports the cost per lookup.
+// Text decoding is what the server does per line: split off the two names
+// and hash them, as the document lookup would. Binary decoding includes
+// checking the frame; the hashes arrive ready made.
+
+#include "ini.h"
+#include "protocol.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+size_t sink = 0; // keeps results from being optimized away
+
+// Run body over and over for the given time; returns nanoseconds per call
+double time_per_call(double seconds, const function<void()>& body) {
+    uint64_t   calls = 0;
+    const auto start = Clock::now();
+    const auto limit = start + chrono::duration<double>(seconds);
+    auto       now   = start;
+    while (now < limit) {
+        for (int i = 0; i < 64; ++i) {
+            body();
+        }
+        calls += 64;
+        now = Clock::now();
+    }
+    return chrono::duration<double, nano>(now - start).count() / static_cast<double>(calls);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const size_t batch   = argc > 1 ? static_cast<size_t>(max(1, atoi(argv[1]))) : 32;
+    const double seconds = argc > 2 ? atof(argv[2]) : 0.5;
+
+    vector<string> sections;
+    vector<string> keys;
+    for (size_t i = 0; i < batch; ++i) {
+        sections.push_back("section" + to_string(i * 7919 % 1000));
+        keys.push_back("key" + to_string(i % 8));
+    }
+    vector<Lookup> lookups;
+    for (size_t i = 0; i < batch; ++i) {
+        lookups.push_back(Lookup { sections[i], keys[i] });
+    }
+    vector<string>                value_storage;
+    vector<optional<string_view>> values;
+    value_storage.reserve(batch);
+    for (size_t i = 0; i < batch; ++i) {
+        value_storage.push_back("value " + to_string(i));
+        values.push_back(i % 10 == 9 ? optional<string_view>() : optional<string_view>(value_storage.back()));
+    }
+
+    string        text_request;
+    string        text_response;
+    string        binary_request;
+    string        binary_response;
+    string        headers;
+    vector<iovec> iov;
+    for (size_t i = 0; i < batch; ++i) {
+        text_request += sections[i] + " " + keys[i] + "\n";
+        text_response += values[i] ? "OK " + string(*values[i]) + "\n" : string("NOTFOUND\n");
+    }
+    encode_request(lookups, binary_request);
+    encode_response(values, headers, iov);
+    for (const iovec& v : iov) {
+        binary_response.append(static_cast<const char*>(v.iov_base), v.iov_len);
+    }
+
+    string                        out;
+    vector<Lookup>                decoded;
+    vector<optional<string_view>> results;
+    size_t                        size = 0;
+
+    struct Case {
+        const char*      name;
+        function<void()> body;
+    };
+    const vector<Case> cases = {
+        {"text request encode", [&] {
+             out.clear();
+             for (size_t i = 0; i < batch; ++i) {
+                 out.append(sections[i]).append(" ").append(keys[i]).append("\n");
+             }
+             sink += out.size();
+         }},
+        {"text request decode", [&] {
+             string_view pending(text_request);
+             size_t      nl;
+             while ((nl = pending.find('\n')) != string_view::npos) {
+                 string_view line = pending.substr(0, nl);
+                 pending.remove_prefix(nl + 1);
+                 string_view section = next_token(line);
+                 string_view key     = next_token(line);
+                 sink += ihash(section) ^ ihash(key);
+             }
+         }},
+        {"text response encode", [&] {
+             out.clear();
+             for (const auto& v : values) {
+                 if (v) {
+                     out.append("OK ").append(*v).append("\n");
+                 } else {
+                     out.append("NOTFOUND\n");
+                 }
+             }
+             sink += out.size();
+         }},
+        {"text response decode", [&] {
+             string_view pending(text_response);
+             size_t      nl;
+             while ((nl = pending.find('\n')) != string_view::npos) {
+                 string_view line = pending.substr(0, nl);
+                 pending.remove_prefix(nl + 1);
+                 sink += line.starts_with("OK ") ? line.size() - 3 : 0;
+             }
+         }},
+        {"binary request encode", [&] {
+             out.clear();
+             encode_request(lookups, out);
+             sink += out.size();
+         }},
+        {"binary request decode", [&] {
+             if (decode_request(binary_request, decoded, size) == FrameStatus::Complete) {
+                 sink += decoded.size() + size;
+             }
+         }},
+        {"binary response encode", [&] {
+             headers.clear();
+             iov.clear();
+             encode_response(values, headers, iov);
+             sink += iov.size();
+         }},
+        {"binary response decode", [&] {
+             if (decode_response(binary_response, results, size) == FrameStatus::Complete) {
+                 sink += results.size() + size;
+             }
+         }},
+    };
+
+    printf("batch of %zu lookups; text request %zu bytes, binary %zu\n", batch, text_request.size(),
+           binary_request.size());
+    printf("%-24s %14s %14s\n", "case", "ns/batch", "ns/lookup");
+    for (const Case& c : cases) {
+        double ns = time_per_call(seconds, c.body);
+        printf("%-24s %14.1f %14.2f\n", c.name, ns, ns / static_cast<double>(batch));
+    }
+    return sink == 0 ? 1 : 0;
+}
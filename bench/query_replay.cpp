@@ -0,0 +1,238 @@
+// Replays a query log against one lookup engine.
+//
+// usage: query_replay <query-log> [stream|document|lazy|tail|server] [socket]
+//
+// Re-issues every lookup of a log written with --log (see querylog.h), in
+// the order it was captured, and reports throughput and the latency
+// distribution. The engines are the ones the command line and the server
+// use:
+//
+//     stream    the default scan, reading each file anew for every lookup
+//     document  a Document per file, parsed once before the clock starts
+//     lazy      a LazyDocument per file, opened once before the clock starts
+//     tail      a TailScanner per file, the --tail path
+//     server    one binary frame per lookup to a server on socket; the
+//               path in the log is ignored
+//
+// The replay is deterministic: the same log always issues the same lookups
+// in the same order, one at a time. Lookups whose outcome differs from the
+// one that was logged are counted, which shows at a glance when the files
+// changed since the capture or when an engine disagrees with another.
+
+#include "document.h"
+#include "ini.h"
+#include "lazydoc.h"
+#include "protocol.h"
+#include "querylog.h"
+#include "tailscan.h"
+#include "workload.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+// The command line's streaming scan over getline
+optional<string> find_streaming(const string& path, string_view section, string_view key) {
+    ifstream file(path);
+    string   text;
+    auto     value = scan(
+        [&](string_view& line) {
+            if (!getline(file, text)) {
+                return false;
+            }
+            line = text;
+            return true;
+        },
+        section, key);
+    return value ? optional<string>(*value) : nullopt;
+}
+
+int connect_to(const string& path) {
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// A lookup through one engine: nullopt on failure, otherwise whether the
+// key was found
+using Engine = function<optional<bool>(const LoggedQuery&)>;
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "usage: %s <query-log> [stream|document|lazy|tail|server] [socket]\n", argv[0]);
+        return 1;
+    }
+    const string_view engine_name = argc > 2 ? argv[2] : "stream";
+
+    string              text;
+    vector<LoggedQuery> queries;
+    if (!read_query_log(argv[1], text, queries)) {
+        fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+        return 3;
+    }
+
+    // Everything an engine opens up front, keyed by file
+    map<string, unique_ptr<Document>, less<>>     documents;
+    map<string, unique_ptr<LazyDocument>, less<>> lazies;
+    map<string, unique_ptr<TailScanner>, less<>>  tails;
+    vector<string>                                failed;
+
+    int                           sock = -1;
+    string                        request;
+    string                        response;
+    vector<Lookup>                lookups(1);
+    vector<optional<string_view>> values;
+
+    Engine     engine;
+    const auto setup = Clock::now();
+    if (engine_name == "stream") {
+        engine = [](const LoggedQuery& q) -> optional<bool> {
+            return find_streaming(string(q.path), q.section, q.key).has_value();
+        };
+    } else if (engine_name == "document") {
+        for (const LoggedQuery& q : queries) {
+            if (documents.find(q.path) == documents.end()) {
+                auto doc = make_unique<Document>();
+                if (!doc->load(string(q.path))) {
+                    failed.emplace_back(q.path);
+                }
+                documents.emplace(string(q.path), std::move(doc));
+            }
+        }
+        engine = [&](const LoggedQuery& q) -> optional<bool> {
+            return documents.find(q.path)->second->get(q.section, q.key).has_value();
+        };
+    } else if (engine_name == "lazy") {
+        for (const LoggedQuery& q : queries) {
+            if (lazies.find(q.path) == lazies.end()) {
+                auto doc = make_unique<LazyDocument>();
+                if (!doc->open(string(q.path))) {
+                    failed.emplace_back(q.path);
+                }
+                lazies.emplace(string(q.path), std::move(doc));
+            }
+        }
+        engine = [&](const LoggedQuery& q) -> optional<bool> {
+            return lazies.find(q.path)->second->get(q.section, q.key).has_value();
+        };
+    } else if (engine_name == "tail") {
+        for (const LoggedQuery& q : queries) {
+            if (tails.find(q.path) == tails.end()) {
+                auto scanner = make_unique<TailScanner>();
+                if (!scanner->open(string(q.path))) {
+                    failed.emplace_back(q.path);
+                }
+                tails.emplace(string(q.path), std::move(scanner));
+            }
+        }
+        engine = [&](const LoggedQuery& q) -> optional<bool> {
+            return tails.find(q.path)->second->find_last(q.section, q.key).has_value();
+        };
+    } else if (engine_name == "server" && argc > 3) {
+        sock = connect_to(argv[3]);
+        if (sock < 0) {
+            fprintf(stderr, "%s: %s\n", argv[3], strerror(errno));
+            return 3;
+        }
+        engine = [&](const LoggedQuery& q) -> optional<bool> {
+            lookups[0] = Lookup { q.section, q.key };
+            request.clear();
+            encode_request(lookups, request);
+            if (::write(sock, request.data(), request.size()) != static_cast<ssize_t>(request.size())) {
+                return nullopt;
+            }
+            response.clear();
+            size_t      size = 0;
+            FrameStatus status;
+            while ((status = decode_response(response, values, size)) == FrameStatus::Incomplete) {
+                char    buf[4096];
+                ssize_t n = ::read(sock, buf, sizeof(buf));
+                if (n <= 0) {
+                    return nullopt;
+                }
+                response.append(buf, static_cast<size_t>(n));
+            }
+            if (status != FrameStatus::Complete || values.size() != 1) {
+                return nullopt;
+            }
+            return values[0].has_value();
+        };
+    } else {
+        fprintf(stderr, "unknown engine \"%s\"%s\n", string(engine_name).c_str(),
+                engine_name == "server" ? " without a socket" : "");
+        return 1;
+    }
+    const double setup_seconds = chrono::duration<double>(Clock::now() - setup).count();
+    for (const string& path : failed) {
+        fprintf(stderr, "warning: could not open %s; its lookups will all miss\n", path.c_str());
+    }
+
+    vector<uint32_t> latency;
+    latency.reserve(queries.size());
+    size_t     found  = 0;
+    size_t     differ = 0;
+    const auto start  = Clock::now();
+    for (const LoggedQuery& q : queries) {
+        auto           before = Clock::now();
+        optional<bool> hit    = engine(q);
+        auto           ns     = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - before).count();
+        if (!hit) {
+            fprintf(stderr, "replay failed after %zu lookups\n", latency.size());
+            return 3;
+        }
+        latency.push_back(static_cast<uint32_t>(min<int64_t>(ns, UINT32_MAX)));
+        found += *hit;
+        differ += *hit != q.found;
+    }
+    const double seconds = chrono::duration<double>(Clock::now() - start).count();
+    if (sock >= 0) {
+        ::close(sock);
+    }
+
+    vector<uint32_t> logged;
+    logged.reserve(queries.size());
+    for (const LoggedQuery& q : queries) {
+        logged.push_back(q.latency_ns);
+    }
+    sort(latency.begin(), latency.end());
+    sort(logged.begin(), logged.end());
+    auto at = [](const vector<uint32_t>& v, double p) {
+        return v.empty() ? 0.0 : v[min(v.size() - 1, static_cast<size_t>(p * v.size()))] / 1000.0;
+    };
+
+    printf("%zu lookups replayed against %s (%.3f s of setup), %zu found, %zu differ from the log\n", queries.size(),
+           string(engine_name).c_str(), setup_seconds, found, differ);
+    printf("%-10s %12s %9s %9s %9s %9s\n", "", "lookups/s", "p50 us", "p99 us", "p99.9 us", "max us");
+    printf("%-10s %12.0f %9.2f %9.2f %9.2f %9.2f\n", "replay", seconds > 0 ? queries.size() / seconds : 0.0,
+           at(latency, 0.5), at(latency, 0.99), at(latency, 0.999), latency.empty() ? 0.0 : latency.back() / 1000.0);
+    printf("%-10s %12s %9.2f %9.2f %9.2f %9.2f\n", "captured", "", at(logged, 0.5), at(logged, 0.99),
+           at(logged, 0.999), logged.empty() ? 0.0 : logged.back() / 1000.0);
+    return 0;
+}
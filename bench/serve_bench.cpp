@@ -0,0 +1,252 @@
+// Load generator for the lookup server.
+//
+// usage: serve_bench [connections] [seconds] [pipeline-depth] [socket [ini-file]]
+//
+// Opens the given number of connections (default 256) and keeps each one
+// busy for the given time: send pipeline-depth requests (default 16) in one
+// write, read all the responses, repeat. Connections are spread over one
+// client thread per hardware thread. Reports requests per second and the
+// latency distribution, where a request's latency runs from the write that
+// carried it to the read that brought back its response.
+//
+// Without a socket the benchmark starts a server in-process on a generated
+// document. With one it drives that server instead, asking for every key
+// of ini-file, or for the generated keys if no file is given.
+
+#include "ini.h"
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+constexpr int sections_in_doc = 1000;
+constexpr int keys_in_section = 8;
+
+string generate_config() {
+    string text;
+    for (int s = 0; s < sections_in_doc; ++s) {
+        text += "[section" + to_string(s) + "]\n";
+        for (int k = 0; k < keys_in_section; ++k) {
+            text += "key" + to_string(k) + " = \"value " + to_string(s * keys_in_section + k) + "\"\n";
+        }
+    }
+    return text;
+}
+
+// Request lines for the generated document; one in ten asks for a key
+// that does not exist
+vector<string> generate_queries() {
+    vector<string> queries;
+    for (int i = 0; i < 4096; ++i) {
+        int section = (i * 7919) % sections_in_doc;
+        int key     = i % 10 == 9 ? keys_in_section : i % keys_in_section;
+        queries.push_back("section" + to_string(section) + " key" + to_string(key) + "\n");
+    }
+    return queries;
+}
+
+// Request lines for every key in an INI file
+vector<string> queries_from_file(const char* path) {
+    vector<string> queries;
+    ifstream       file(path);
+    string         line;
+    string         section;
+    Entry          entry;
+    while (getline(file, line)) {
+        string_view trimmed = trim(line);
+        if (is_header(trimmed)) {
+            section = header_name(trimmed);
+        } else if (!section.empty() && parse_section_entry(trimmed, entry) && entry.valid()) {
+            queries.push_back("[" + section + "] [" + string(entry.name()) + "]\n");
+        }
+    }
+    return queries;
+}
+
+int connect_to(const string& path) {
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+bool write_all(int fd, const string& data) {
+    for (size_t off = 0; off < data.size();) {
+        ssize_t n = ::write(fd, data.data() + off, data.size() - off);
+        if (n <= 0) {
+            return false;
+        }
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+struct ClientStats {
+    uint64_t         requests = 0;
+    uint64_t         errors   = 0;
+    vector<uint32_t> latency_ns;
+};
+
+// Drive a set of connections round-robin: write a batch to every one, then
+// collect every batch's responses
+void drive(const vector<int>& fds, const vector<string>& queries, int depth, const atomic<bool>& stop,
+           unsigned seed, ClientStats& stats) {
+    mt19937                   rng(seed);
+    vector<string>            batches(fds.size());
+    vector<Clock::time_point> sent(fds.size());
+    char                      buf[64 * 1024];
+
+    while (!stop.load(memory_order_relaxed)) {
+        for (size_t c = 0; c < fds.size(); ++c) {
+            batches[c].clear();
+            for (int i = 0; i < depth; ++i) {
+                batches[c] += queries[rng() % queries.size()];
+            }
+            sent[c] = Clock::now();
+            if (!write_all(fds[c], batches[c])) {
+                ++stats.errors;
+                return;
+            }
+        }
+
+        for (size_t c = 0; c < fds.size(); ++c) {
+            for (int answered = 0; answered < depth;) {
+                ssize_t n = ::read(fds[c], buf, sizeof(buf));
+                if (n <= 0) {
+                    ++stats.errors;
+                    return;
+                }
+                auto now = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - sent[c]).count();
+                for (char ch : string_view(buf, static_cast<size_t>(n))) {
+                    if (ch == '\n') {
+                        stats.latency_ns.push_back(static_cast<uint32_t>(min<int64_t>(now, UINT32_MAX)));
+                        ++answered;
+                    }
+                }
+            }
+            stats.requests += static_cast<uint64_t>(depth);
+        }
+    }
+}
+
+double percentile(const vector<uint32_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t i = min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())));
+    return sorted[i] / 1000.0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const int    connections = argc > 1 ? max(1, atoi(argv[1])) : 256;
+    const double seconds     = argc > 2 ? atof(argv[2]) : 2.0;
+    const int    depth       = argc > 3 ? max(1, atoi(argv[3])) : 16;
+
+    SnapshotHandle docs;
+    Server         server(docs);
+    string         socket_path;
+    vector<string> queries;
+
+    if (argc > 4) {
+        socket_path = argv[4];
+        queries     = argc > 5 ? queries_from_file(argv[5]) : generate_queries();
+    } else {
+        auto doc = make_unique<Document>();
+        doc->parse(generate_config());
+        docs.publish(std::move(doc));
+
+        char dir[] = "/tmp/serve_bench.XXXXXX";
+        if (!::mkdtemp(dir)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        socket_path = string(dir) + "/sock";
+        if (!server.listen(socket_path) || !server.start()) {
+            perror("server");
+            return 1;
+        }
+        queries = generate_queries();
+    }
+    if (queries.empty()) {
+        fprintf(stderr, "no keys to ask for\n");
+        return 1;
+    }
+
+    const unsigned threads = min(static_cast<unsigned>(connections), max(1u, thread::hardware_concurrency()));
+    vector<vector<int>> fds(threads);
+    for (int c = 0; c < connections; ++c) {
+        int fd = connect_to(socket_path);
+        if (fd < 0) {
+            perror("connect");
+            return 1;
+        }
+        fds[static_cast<size_t>(c) % threads].push_back(fd);
+    }
+
+    atomic<bool>        stop {false};
+    vector<ClientStats> stats(threads);
+    vector<thread>      clients;
+    for (unsigned t = 0; t < threads; ++t) {
+        clients.emplace_back(drive, cref(fds[t]), cref(queries), depth, cref(stop), t, ref(stats[t]));
+    }
+    this_thread::sleep_for(chrono::duration<double>(seconds));
+    stop.store(true);
+    for (auto& c : clients) {
+        c.join();
+    }
+
+    uint64_t         requests = 0;
+    uint64_t         errors   = 0;
+    vector<uint32_t> latency;
+    for (ClientStats& s : stats) {
+        requests += s.requests;
+        errors += s.errors;
+        latency.insert(latency.end(), s.latency_ns.begin(), s.latency_ns.end());
+    }
+    sort(latency.begin(), latency.end());
+
+    printf("%d connections, pipeline depth %d, %u client threads\n", connections, depth, threads);
+    printf("%12s %10s %10s %10s %10s\n", "requests/s", "p50 us", "p99 us", "p99.9 us", "max us");
+    printf("%12.0f %10.1f %10.1f %10.1f %10.1f\n", static_cast<double>(requests) / seconds,
+           percentile(latency, 0.50), percentile(latency, 0.99), percentile(latency, 0.999),
+           latency.empty() ? 0.0 : latency.back() / 1000.0);
+    if (errors > 0) {
+        printf("connections lost: %llu\n", static_cast<unsigned long long>(errors));
+    }
+
+    for (auto& set : fds) {
+        for (int fd : set) {
+            ::close(fd);
+        }
+    }
+    server.stop();
+    if (argc <= 4) {
+        ::rmdir(socket_path.substr(0, socket_path.rfind('/')).c_str());
+    }
+    return 0;
+}
@@ -0,0 +1,207 @@
+// Round-trip latency of the shared-memory channel against the Unix socket.
+//
+// usage: shm_bench [round-trips] [socket]
+//
+// Performs the given number of single-key lookups (default 200000), one at
+// a time, over a ShmChannel, over the socket with binary frames and over
+// the socket with text requests, and reports the latency distribution of
+// each. Without a socket the benchmark forks a server process on a
+// generated document, so every round trip crosses processes.
+//
+// Sub-microsecond channel latency needs a spare core for each side to spin
+// on; on a single CPU every round trip goes through a futex wakeup.
+
+#include "protocol.h"
+#include "server.h"
+#include "shmring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+constexpr int sections_in_doc = 1000;
+constexpr int keys_in_section = 8;
+
+string generate_config() {
+    string text;
+    for (int s = 0; s < sections_in_doc; ++s) {
+        text += "[section" + to_string(s) + "]\n";
+        for (int k = 0; k < keys_in_section; ++k) {
+            text += "key" + to_string(k) + " = \"value " + to_string(s * keys_in_section + k) + "\"\n";
+        }
+    }
+    return text;
+}
+
+// Run a server on the generated document until killed
+[[noreturn]] void server_process(const string& socket_path) {
+    SnapshotHandle docs;
+    auto           doc = make_unique<Document>();
+    doc->parse(generate_config());
+    docs.publish(std::move(doc));
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    Server server(docs);
+    if (!server.listen(socket_path) || !server.start(2)) {
+        perror("server");
+        _exit(1);
+    }
+    int sig = 0;
+    sigwait(&signals, &sig);
+    server.stop();
+    _exit(0);
+}
+
+int connect_to(const string& path) {
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Send a request and read until a full response has arrived
+bool socket_round_trip(int fd, const string& request, string& response, const function<bool(const string&)>& done) {
+    if (::write(fd, request.data(), request.size()) != static_cast<ssize_t>(request.size())) {
+        return false;
+    }
+    response.clear();
+    char buf[4096];
+    while (!done(response)) {
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return false;
+        }
+        response.append(buf, static_cast<size_t>(n));
+    }
+    return true;
+}
+
+void report(const char* name, vector<uint32_t>& latency, double seconds) {
+    sort(latency.begin(), latency.end());
+    auto at = [&](double p) {
+        return latency.empty() ? 0.0 : latency[min(latency.size() - 1, static_cast<size_t>(p * latency.size()))] / 1000.0;
+    };
+    printf("%-16s %12.0f %9.2f %9.2f %9.2f %9.2f\n", name, static_cast<double>(latency.size()) / seconds, at(0.5),
+           at(0.99), at(0.999), latency.empty() ? 0.0 : latency.back() / 1000.0);
+}
+
+// Time one round trip per call of step, which returns false on failure
+void measure(const char* name, int rounds, const function<bool(int)>& step) {
+    vector<uint32_t> latency;
+    latency.reserve(static_cast<size_t>(rounds));
+    const auto start = Clock::now();
+    for (int i = 0; i < rounds; ++i) {
+        auto before = Clock::now();
+        if (!step(i)) {
+            printf("%-16s failed after %d round trips\n", name, i);
+            return;
+        }
+        auto ns = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - before).count();
+        latency.push_back(static_cast<uint32_t>(min<int64_t>(ns, UINT32_MAX)));
+    }
+    report(name, latency, chrono::duration<double>(Clock::now() - start).count());
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const int rounds = argc > 1 ? max(1, atoi(argv[1])) : 200000;
+
+    string socket_path;
+    pid_t  child = -1;
+    char   dir[] = "/tmp/shm_bench.XXXXXX";
+    if (argc > 2) {
+        socket_path = argv[2];
+    } else {
+        if (!::mkdtemp(dir)) {
+            perror("mkdtemp");
+            return 1;
+        }
+        socket_path = string(dir) + "/sock";
+        child       = ::fork();
+        if (child == 0) {
+            server_process(socket_path);
+        }
+    }
+
+    int fd = -1;
+    for (int tries = 0; fd < 0 && tries < 500; ++tries) {
+        fd = connect_to(socket_path);
+        if (fd < 0) {
+            this_thread::sleep_for(chrono::milliseconds(10));
+        }
+    }
+    ShmClient channel;
+    if (fd < 0 || !channel.connect(socket_path)) {
+        perror("connect");
+        return 1;
+    }
+
+    vector<string> sections;
+    vector<string> keys;
+    for (int i = 0; i < 1024; ++i) {
+        sections.push_back("section" + to_string(i * 7919 % sections_in_doc));
+        keys.push_back("key" + to_string(i % keys_in_section));
+    }
+
+    printf("%d round trips, one lookup each\n", rounds);
+    printf("%-16s %12s %9s %9s %9s %9s\n", "transport", "lookups/s", "p50 us", "p99 us", "p99.9 us", "max us");
+
+    vector<Lookup>                lookups(1);
+    vector<optional<string_view>> values;
+    measure("shared memory", rounds, [&](int i) {
+        lookups[0] = Lookup { sections[i % 1024], keys[i % 1024] };
+        return channel.lookup(lookups, values) && values[0];
+    });
+
+    string request;
+    string response;
+    measure("socket binary", rounds, [&](int i) {
+        lookups[0] = Lookup { sections[i % 1024], keys[i % 1024] };
+        request.clear();
+        encode_request(lookups, request);
+        size_t size = 0;
+        return socket_round_trip(fd, request, response, [&](const string& r) {
+            return decode_response(r, values, size) != FrameStatus::Incomplete;
+        });
+    });
+
+    measure("socket text", rounds, [&](int i) {
+        request = sections[i % 1024] + " " + keys[i % 1024] + "\n";
+        return socket_round_trip(fd, request, response, [](const string& r) { return r.find('\n') != string::npos; });
+    });
+
+    ::close(fd);
+    if (child > 0) {
+        ::kill(child, SIGTERM);
+        ::waitpid(child, nullptr, 0);
+        ::rmdir(dir);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+// Stress benchmark for SnapshotHandle: read throughput while reloading.
+//
+// usage: snapshot_bench [max-threads] [seconds-per-step] [reload-interval-ms]
+//
+// Runs 1, 2, 4, ... reader threads up to max-threads (default: the number
+// of hardware threads). Every reader looks up random keys through a fresh
+// snapshot per lookup while one writer thread republishes the document at
+// the given interval. Throughput should scale with the reader count, since
+// readers share no written cache lines.
+
+#include "snapshot.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+constexpr int sections_in_doc = 1000;
+constexpr int keys_in_section = 8;
+
+string generate_config() {
+    string text;
+    for (int s = 0; s < sections_in_doc; ++s) {
+        text += "[section" + to_string(s) + "]\n";
+        for (int k = 0; k < keys_in_section; ++k) {
+            text += "key" + to_string(k) + " = \"value " + to_string(s * keys_in_section + k) + "\"\n";
+        }
+    }
+    return text;
+}
+
+atomic<size_t> sink {0}; // keeps the lookups from being optimized away
+
+unique_ptr<Document> make_document(const string& text) {
+    auto doc = make_unique<Document>();
+    doc->parse(text);
+    return doc;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    const int    max_threads = argc > 1 ? atoi(argv[1]) : max(1u, thread::hardware_concurrency());
+    const double seconds     = argc > 2 ? atof(argv[2]) : 1.0;
+    const int    reload_ms   = argc > 3 ? atoi(argv[3]) : 1;
+
+    const string text = generate_config();
+
+    // Lookup names are prebuilt so the loop measures snapshots, not strings
+    vector<pair<string, string>> queries;
+    for (int i = 0; i < 4096; ++i) {
+        queries.emplace_back("section" + to_string((i * 7919) % sections_in_doc),
+                             "key" + to_string(i % keys_in_section));
+    }
+
+    SnapshotHandle handle;
+    handle.publish(make_document(text));
+
+    vector<int> steps;
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        steps.push_back(threads);
+    }
+    steps.push_back(max_threads);
+
+    printf("%8s %16s %16s %10s\n", "threads", "reads/s", "reads/s/thread", "reloads");
+    for (int threads : steps) {
+        atomic<bool>     stop {false};
+        vector<uint64_t> counts(static_cast<size_t>(threads));
+        vector<thread>   workers;
+
+        const uint64_t gen_before = handle.generation();
+        thread         reloader([&] {
+            while (!stop.load(memory_order_relaxed)) {
+                handle.publish(make_document(text));
+                this_thread::sleep_for(chrono::milliseconds(reload_ms));
+            }
+        });
+
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                mt19937  rng(static_cast<unsigned>(t));
+                uint64_t n     = 0;
+                size_t   bytes = 0;
+                while (!stop.load(memory_order_relaxed)) {
+                    for (int i = 0; i < 256; ++i) {
+                        const auto& [section, key] = queries[rng() % queries.size()];
+                        Snapshot    snap           = handle.read();
+                        if (auto v = snap->get(section, key)) {
+                            bytes += v->size();
+                        }
+                    }
+                    n += 256;
+                }
+                counts[static_cast<size_t>(t)] = n;
+                sink += bytes;
+            });
+        }
+
+        this_thread::sleep_for(chrono::duration<double>(seconds));
+        stop.store(true);
+        for (auto& w : workers) {
+            w.join();
+        }
+        reloader.join();
+
+        uint64_t total = 0;
+        for (uint64_t c : counts) {
+            total += c;
+        }
+        const double rate = static_cast<double>(total) / seconds;
+        printf("%8d %16.0f %16.0f %10llu\n", threads, rate, rate / threads,
+               static_cast<unsigned long long>(handle.generation() - gen_before));
+    }
+
+    printf("retired documents still pending: %zu\n", handle.pending());
+    return 0;
+}
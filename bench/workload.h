@@ -0,0 +1,58 @@
+// The generated config and the streaming scan shared by the benchmarks.
+//
+// write_config() writes the same file every benchmark that needs one on
+// disk generates, eight keys to a section, so that their figures can be
+// compared. scan() applies the command line's streaming lookup rules to
+// lines from any source, which lets a benchmark time the way the lines are
+// read apart from the rules themselves.
+
+#pragma once
+
+#include "ini.h"
+
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+
+constexpr int keys_in_section = 8;
+
+// Write entries keys to path, key0 to key7 of section0, section1, ...
+inline bool write_config(const std::string& path, int entries) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    for (int i = 0; i < entries; ++i) {
+        if (i % keys_in_section == 0) {
+            out << "[section" << i / keys_in_section << "]\n";
+        }
+        out << "key" << i % keys_in_section << " = \"value " << i << "\"\n";
+    }
+    out.flush();
+    return out.good();
+}
+
+// The streaming scan's rules over lines produced by next_line: the first
+// block of the section decides
+inline std::optional<std::string_view> scan(const std::function<bool(std::string_view&)>& next_line,
+                                            std::string_view section, std::string_view key) {
+    std::string_view line;
+    bool             in_section = false;
+    Entry            entry;
+    while (next_line(line)) {
+        std::string_view trimmed = trim(line);
+        if (is_ignorable(trimmed)) {
+            continue;
+        }
+        if (is_header(trimmed)) {
+            if (in_section) {
+                break;
+            }
+            in_section = is_section(trimmed, section);
+            continue;
+        }
+        if (in_section && parse_section_entry(trimmed, entry) && entry.valid() && iequals(entry.name(), key)) {
+            return entry.value();
+        }
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,90 @@
+// Lookup of one key in a large buffer, scanned as chunks in parallel.
+
+#include "chunkscan.h"
+
+#include "ini.h"
+#include "trace.h"
+
+using namespace std;
+
+vector<string_view> split_chunks(string_view text, size_t chunk_size) {
+    vector<string_view> chunks;
+    while (!text.empty()) {
+        size_t end = text.size();
+        if (chunk_size < text.size()) {
+            size_t eol = text.find('\n', chunk_size - 1);
+            end        = eol == string_view::npos ? text.size() : eol + 1;
+        }
+        chunks.push_back(text.substr(0, end));
+        text.remove_prefix(end);
+    }
+    return chunks;
+}
+
+ChunkScan scan_chunk(string_view chunk, string_view section, string_view key, Merge merge) {
+    TraceScope trace("chunk");
+    ChunkScan  scan;
+    Entry      entry;
+
+    // Where a match goes: the lead before any header, then the block of the
+    // section begun by the last header, or nowhere after another header
+    optional<string_view>* match = &scan.lead;
+    while (!chunk.empty()) {
+        size_t      eol  = chunk.find('\n');
+        string_view line = chunk.substr(0, eol);
+        chunk.remove_prefix(eol == string_view::npos ? chunk.size() : eol + 1);
+
+        string_view trimmed = trim(line);
+        if (is_ignorable(trimmed)) {
+            continue;
+        }
+
+        if (is_header(trimmed)) {
+            scan.headers    = true;
+            scan.in_section = is_section(trimmed, section);
+            if (scan.in_section) {
+                scan.blocks.emplace_back();
+                match = &scan.blocks.back();
+            } else {
+                match = nullptr;
+            }
+            continue;
+        }
+
+        if (match && (!*match || merge == Merge::LastWins) && parse_section_entry(trimmed, entry) && entry.valid()
+            && iequals(entry.name(), key)) {
+            *match = entry.value();
+        }
+    }
+    return scan;
+}
+
+optional<string_view> join_chunks(const vector<ChunkScan>& scans, Merge merge) {
+    optional<string_view> value;
+    bool                  in_section = false;
+    size_t                blocks     = 0; // of the section, seen so far
+
+    // With Merge::None only the first block of the section counts
+    auto offer = [&](const optional<string_view>& match) {
+        if (match && (merge != Merge::None || blocks == 1) && (!value || merge == Merge::LastWins)) {
+            value = match;
+        }
+    };
+
+    for (const ChunkScan& scan : scans) {
+        if (in_section) {
+            offer(scan.lead);
+        }
+        for (const auto& block : scan.blocks) {
+            ++blocks;
+            offer(block);
+        }
+        if (value && merge != Merge::LastWins) {
+            break; // nothing later comes first
+        }
+        if (scan.headers) {
+            in_section = scan.in_section;
+        }
+    }
+    return value;
+}
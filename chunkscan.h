@@ -0,0 +1,39 @@
+// Lookup of one key in a large buffer, scanned as chunks in parallel.
+//
+// A chunk cut from the middle of a file does not know which section its
+// first lines belong to. scan_chunk() therefore records what a chunk holds
+// of the key without that knowledge: the matching entry in its lines before
+// any header, the matching entry of every block of the wanted section that
+// starts in it, and whether it ends inside that section. join_chunks()
+// walks those records in file order and settles the value, which is the
+// same as Document::get() on the whole buffer under each Merge mode.
+//
+// Chunks end at line ends, so no line is split between two of them.
+
+#pragma once
+
+#include "document.h"
+
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+struct ChunkScan {
+    std::optional<std::string_view>              lead;   // match before the first header
+    std::vector<std::optional<std::string_view>> blocks; // match in each block of the section
+    bool                                         headers    = false; // the chunk has any header
+    bool                                         in_section = false; // its last header is the section's
+};
+
+// Cut text into pieces of about chunk_size bytes, each ending after a '\n'
+// or at the end of text
+[[nodiscard]] std::vector<std::string_view> split_chunks(std::string_view text, size_t chunk_size);
+
+// Scan one chunk for key in section. Within a block the first match is kept,
+// or the last with Merge::LastWins.
+[[nodiscard]] ChunkScan scan_chunk(std::string_view chunk, std::string_view section, std::string_view key,
+                                   Merge merge);
+
+// Value of key from the scans of consecutive chunks, in file order
+[[nodiscard]] std::optional<std::string_view> join_chunks(const std::vector<ChunkScan>& scans, Merge merge);
@@ -0,0 +1,210 @@
+// Typed conversions of raw INI values.
+
+#include "convert.h"
+
+#include "ini.h"
+
+#include <charconv>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+
+namespace {
+
+// Strip a single leading '+'; from_chars only understands '-'
+string_view skip_plus(string_view sv) noexcept {
+    if (!sv.empty() && sv.front() == '+') {
+        sv.remove_prefix(1);
+    }
+    return sv;
+}
+
+// Parse the numeric prefix of a "<number><unit>" value. Integers are kept
+// exact; anything with a fraction or exponent falls back to double. Returns
+// the unit that follows, trimmed, or nullopt if there is no number at all.
+struct Quantity {
+    bool    integral = true;
+    int64_t i        = 0;
+    double  d        = 0;
+};
+
+optional<string_view> split_quantity(string_view sv, Quantity& q) noexcept {
+    sv                = skip_plus(trim(sv));
+    const char* first = sv.data();
+    const char* last  = sv.data() + sv.size();
+
+    auto [iend, iec]  = from_chars(first, last, q.i);
+    if (iec == errc {} && (iend == last || (*iend != '.' && *iend != 'e' && *iend != 'E'))) {
+        q.integral = true;
+        return trim(string_view(iend, static_cast<size_t>(last - iend)));
+    }
+
+    auto [dend, dec] = from_chars(first, last, q.d, chars_format::fixed | chars_format::scientific);
+    if (dec != errc {} || !isfinite(q.d)) {
+        return nullopt;
+    }
+    q.integral = false;
+    return trim(string_view(dend, static_cast<size_t>(last - dend)));
+}
+
+// Scale a quantity by a unit factor, rejecting anything that does not fit
+optional<int64_t> scale(const Quantity& q, int64_t factor) noexcept {
+    if (q.integral) {
+        int64_t out;
+        if (__builtin_mul_overflow(q.i, factor, &out)) {
+            return nullopt;
+        }
+        return out;
+    }
+    double out = q.d * static_cast<double>(factor);
+    if (!(out > -9.2e18 && out < 9.2e18)) {
+        return nullopt;
+    }
+    return static_cast<int64_t>(llround(out));
+}
+
+struct Unit {
+    string_view name;
+    int64_t     factor;
+};
+
+constexpr Unit duration_units[] = {
+    {"ns", 1},
+    {"us", 1'000},
+    {"ms", 1'000'000},
+    {"s", 1'000'000'000},
+    {"", 1'000'000'000},
+    {"m", 60'000'000'000},
+    {"min", 60'000'000'000},
+    {"h", 3'600'000'000'000},
+    {"d", 86'400'000'000'000},
+};
+
+constexpr Unit size_units[] = {
+    {"", 1},
+    {"b", 1},
+    {"k", 1ll << 10},
+    {"kib", 1ll << 10},
+    {"kb", 1'000},
+    {"m", 1ll << 20},
+    {"mib", 1ll << 20},
+    {"mb", 1'000'000},
+    {"g", 1ll << 30},
+    {"gib", 1ll << 30},
+    {"gb", 1'000'000'000},
+    {"t", 1ll << 40},
+    {"tib", 1ll << 40},
+    {"tb", 1'000'000'000'000},
+};
+
+template <size_t N>
+optional<int64_t> lookup_unit(const Unit (&units)[N], string_view name) noexcept {
+    for (const Unit& u : units) {
+        if (iequals(u.name, name)) {
+            return u.factor;
+        }
+    }
+    return nullopt;
+}
+
+} // namespace
+
+// Signed decimal integer, or hexadecimal with a 0x prefix
+optional<int64_t> to_int(string_view sv) noexcept {
+    sv       = trim(sv);
+    bool neg = false;
+    if (!sv.empty() && (sv.front() == '-' || sv.front() == '+')) {
+        neg = sv.front() == '-';
+        sv.remove_prefix(1);
+    }
+
+    int base = 10;
+    if (sv.size() > 2 && sv[0] == '0' && (sv[1] == 'x' || sv[1] == 'X')) {
+        base = 16;
+        sv.remove_prefix(2);
+    }
+
+    uint64_t    mag = 0;
+    const char* last = sv.data() + sv.size();
+    auto [end, ec]   = from_chars(sv.data(), last, mag, base);
+    if (sv.empty() || ec != errc {} || end != last) {
+        return nullopt;
+    }
+
+    constexpr uint64_t max = static_cast<uint64_t>(numeric_limits<int64_t>::max());
+    if (neg) {
+        if (mag > max + 1) {
+            return nullopt;
+        }
+        return static_cast<int64_t>(0 - mag);
+    }
+    if (mag > max) {
+        return nullopt;
+    }
+    return static_cast<int64_t>(mag);
+}
+
+// true/false, yes/no, on/off or 1/0, in any case
+optional<bool> to_bool(string_view sv) noexcept {
+    sv = trim(sv);
+    for (string_view t : {"true", "yes", "on", "1"}) {
+        if (iequals(sv, t)) {
+            return true;
+        }
+    }
+    for (string_view f : {"false", "no", "off", "0"}) {
+        if (iequals(sv, f)) {
+            return false;
+        }
+    }
+    return nullopt;
+}
+
+// Floating point number in fixed or scientific notation
+optional<double> to_double(string_view sv) noexcept {
+    sv               = skip_plus(trim(sv));
+    const char* last = sv.data() + sv.size();
+    double      d    = 0;
+    auto [end, ec]   = from_chars(sv.data(), last, d);
+    if (sv.empty() || ec != errc {} || end != last) {
+        return nullopt;
+    }
+    return d;
+}
+
+// Number followed by a time unit, e.g. "250ms"
+optional<chrono::nanoseconds> to_duration(string_view sv) noexcept {
+    Quantity q;
+    auto     unit = split_quantity(sv, q);
+    if (!unit) {
+        return nullopt;
+    }
+    auto factor = lookup_unit(duration_units, *unit);
+    if (!factor) {
+        return nullopt;
+    }
+    auto ns = scale(q, *factor);
+    if (!ns) {
+        return nullopt;
+    }
+    return chrono::nanoseconds(*ns);
+}
+
+// Byte count with an optional binary or decimal suffix, e.g. "4GiB"
+optional<uint64_t> to_size(string_view sv) noexcept {
+    Quantity q;
+    auto     unit = split_quantity(sv, q);
+    if (!unit) {
+        return nullopt;
+    }
+    auto factor = lookup_unit(size_units, *unit);
+    if (!factor) {
+        return nullopt;
+    }
+    auto bytes = scale(q, *factor);
+    if (!bytes || *bytes < 0) {
+        return nullopt;
+    }
+    return static_cast<uint64_t>(*bytes);
+}
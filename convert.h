@@ -0,0 +1,29 @@
+// Typed conversions of raw INI values.
+//
+// All conversions are built on std::from_chars and never allocate. Each one
+// returns std::nullopt when the whole value cannot be converted; trailing
+// garbage is an error, not something to silently ignore.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// Signed decimal integer, or hexadecimal with a 0x prefix
+[[nodiscard]] std::optional<int64_t> to_int(std::string_view sv) noexcept;
+
+// true/false, yes/no, on/off or 1/0, in any case
+[[nodiscard]] std::optional<bool> to_bool(std::string_view sv) noexcept;
+
+// Floating point number in fixed or scientific notation
+[[nodiscard]] std::optional<double> to_double(std::string_view sv) noexcept;
+
+// Number followed by a unit: ns, us, ms, s, m (or min), h or d, e.g. "250ms"
+// or "1.5h". A bare number is taken as seconds.
+[[nodiscard]] std::optional<std::chrono::nanoseconds> to_duration(std::string_view sv) noexcept;
+
+// Byte count with an optional suffix, e.g. "4GiB". KiB/MiB/GiB/TiB and the
+// single letters K/M/G/T are powers of 1024; KB/MB/GB/TB are powers of 1000.
+[[nodiscard]] std::optional<uint64_t> to_size(std::string_view sv) noexcept;
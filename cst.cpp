@@ -0,0 +1,347 @@
+// Lossless concrete syntax tree for editing INI files in memory.
+
+#include "cst.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <fstream>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+bool SyntaxTree::load(const filesystem::path& path) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    string contents;
+    char   chunk[64 * 1024];
+    while (file.read(chunk, sizeof(chunk)) || file.gcount() > 0) {
+        contents.append(chunk, static_cast<size_t>(file.gcount()));
+    }
+    if (file.bad()) {
+        return false;
+    }
+
+    parse(std::move(contents));
+    return true;
+}
+
+void SyntaxTree::parse(string text) {
+    src = std::move(text);
+    eol = "\n";
+    source_lines.clear();
+    blocks.clear();
+    replaced.clear();
+    inserted.clear();
+    appended.clear();
+
+    const char* base = src.data();
+    Entry       entry;
+    Block*      current = nullptr;
+    string_view rest(src);
+
+    while (!rest.empty()) {
+        size_t      nl  = rest.find('\n');
+        string_view raw = rest.substr(0, nl);
+        rest.remove_prefix(nl == string_view::npos ? rest.size() : nl + 1);
+
+        Line line;
+        line.begin = static_cast<uint64_t>(raw.data() - base);
+        line.room  = line.begin + raw.size();
+        line.end   = nl == string_view::npos ? line.room : line.room + 1;
+        if (raw.ends_with('\r')) {
+            --line.room;
+            if (source_lines.empty()) {
+                eol = "\r\n";
+            }
+        }
+
+        auto offset_of = [base](string_view sv) { return static_cast<uint64_t>(sv.data() - base); };
+
+        string_view trimmed = trim(raw);
+        if (trimmed.empty()) {
+            line.kind = Kind::Blank;
+        } else if (is_ignorable(trimmed)) {
+            line.kind = Kind::Comment;
+        } else if (is_header(trimmed)) {
+            string_view name = header_name(trimmed);
+            line.kind        = Kind::Header;
+            line.name_begin  = offset_of(name);
+            line.name_end    = line.name_begin + name.size();
+
+            if (current) {
+                current->last = source_lines.size();
+                current       = nullptr;
+            }
+            auto [it, added] = blocks.try_emplace(name, Block { source_lines.size() + 1, 0 });
+            if (added) {
+                current = &it->second;
+            }
+        } else if (parse_section_entry(trimmed, entry)) {
+            line.kind        = Kind::Entry;
+            line.name_begin  = offset_of(entry.name());
+            line.name_end    = line.name_begin + entry.name().size();
+            line.value_begin = offset_of(entry.value());
+            line.value_end   = line.value_begin + entry.value().size();
+            line.quoted      = entry.value().data() + entry.value().size() < trimmed.data() + trimmed.size();
+        } else {
+            line.kind = Kind::Other;
+        }
+        source_lines.push_back(line);
+    }
+
+    if (current) {
+        current->last = source_lines.size();
+    }
+}
+
+string_view SyntaxTree::slice(uint64_t begin, uint64_t end) const noexcept {
+    return string_view(src).substr(begin, end - begin);
+}
+
+const SyntaxTree::Block* SyntaxTree::block(string_view section) const {
+    auto it = blocks.find(section);
+    return it == blocks.end() ? nullptr : &it->second;
+}
+
+// First live entry with key in the block. Entries without a value are
+// skipped, as the lookup skips them, and so are lines deleted by an edit.
+const SyntaxTree::Line* SyntaxTree::entry(const Block& b, string_view key) const {
+    for (size_t i = b.first; i < b.last; ++i) {
+        const Line& line = source_lines[i];
+        if (line.kind != Kind::Entry || line.value_begin == line.value_end
+            || !iequals(slice(line.name_begin, line.name_end), key)) {
+            continue;
+        }
+        auto r = replaced.find(line.begin);
+        if (r != replaced.end() && r->second.deleted) {
+            continue;
+        }
+        return &line;
+    }
+    return nullptr;
+}
+
+// Just past the last line of the block that is not blank or a comment, so
+// new keys land with the section's other entries rather than in front of
+// whatever leads into the next section
+uint64_t SyntaxTree::insertion_point(const Block& b) const {
+    for (size_t i = b.last; i > b.first; --i) {
+        Kind k = source_lines[i - 1].kind;
+        if (k != Kind::Blank && k != Kind::Comment) {
+            return source_lines[i - 1].end;
+        }
+    }
+    return source_lines[b.first - 1].end;
+}
+
+SyntaxTree::NewSection* SyntaxTree::new_section(string_view section) {
+    auto it = find_if(appended.begin(), appended.end(), [&](const NewSection& s) { return iequals(s.name, section); });
+    return it == appended.end() ? nullptr : &*it;
+}
+
+optional<string_view> SyntaxTree::get(string_view section, string_view key) const {
+    auto find_added = [&](const vector<Added>& entries) -> optional<string_view> {
+        for (const Added& a : entries) {
+            if (iequals(a.key, key)) {
+                return a.value;
+            }
+        }
+        return nullopt;
+    };
+
+    if (const Block* b = block(section)) {
+        if (const Line* line = entry(*b, key)) {
+            auto r = replaced.find(line->value_begin);
+            return r != replaced.end() ? string_view(r->second.value) : slice(line->value_begin, line->value_end);
+        }
+        auto at = inserted.find(insertion_point(*b));
+        return at == inserted.end() ? nullopt : find_added(at->second);
+    }
+    for (const NewSection& s : appended) {
+        if (iequals(s.name, section)) {
+            return find_added(s.entries);
+        }
+    }
+    return nullopt;
+}
+
+bool SyntaxTree::set(string_view section, string_view key, string_view value) {
+    if (!fits_on_line(section, key, value)) {
+        return false;
+    }
+    auto set_added = [&](vector<Added>& entries) {
+        for (Added& a : entries) {
+            if (iequals(a.key, key)) {
+                a.value = value;
+                return;
+            }
+        }
+        entries.push_back(Added { string(key), string(value) });
+    };
+
+    if (const Block* b = block(section)) {
+        if (const Line* line = entry(*b, key)) {
+            string text(value);
+            if (line->quoted) {
+                text += '"';
+            } else if (needs_quotes(value)) {
+                text = '"' + text + '"';
+            }
+            replaced.insert_or_assign(line->value_begin, Replacement { line->room, std::move(text), string(value) });
+            return true;
+        }
+        set_added(inserted[insertion_point(*b)]);
+        return true;
+    }
+    if (NewSection* s = new_section(section)) {
+        set_added(s->entries);
+        return true;
+    }
+    return false;
+}
+
+bool SyntaxTree::remove(string_view section, string_view key) {
+    auto remove_added = [&](vector<Added>& entries) {
+        return erase_if(entries, [&](const Added& a) { return iequals(a.key, key); }) > 0;
+    };
+
+    if (const Block* b = block(section)) {
+        if (const Line* line = entry(*b, key)) {
+            replaced.erase(line->value_begin);
+            replaced.insert_or_assign(line->begin, Replacement { line->end, {}, {}, true });
+            return true;
+        }
+        auto at = inserted.find(insertion_point(*b));
+        return at != inserted.end() && remove_added(at->second);
+    }
+    if (NewSection* s = new_section(section)) {
+        return remove_added(s->entries);
+    }
+    return false;
+}
+
+bool SyntaxTree::add_section(string_view section) {
+    if (!fits_on_line(section, {}, {}) || block(section) || new_section(section)) {
+        return false;
+    }
+    appended.push_back(NewSection { string(section), {} });
+    return true;
+}
+
+bool SyntaxTree::modified() const noexcept {
+    return !replaced.empty() || !inserted.empty() || !appended.empty();
+}
+
+// Walk the source once, emitting untouched slices between overlays. Text
+// generated for inserted entries and new sections goes into storage, which
+// is reserved up front so the pieces pointing into it stay valid.
+void SyntaxTree::gather(vector<string_view>& pieces, vector<string>& storage) const {
+    storage.reserve(inserted.size() + 1);
+
+    bool     open_end = !src.empty() && src.back() != '\n'; // output so far lacks a final line break
+    uint64_t pos      = 0;
+    auto     rep      = replaced.begin();
+    auto     ins      = inserted.begin();
+
+    auto render = [&](const vector<Added>& entries) {
+        string& text = storage.emplace_back();
+        if (open_end && pos == src.size()) {
+            text += eol;
+            open_end = false;
+        }
+        for (const Added& a : entries) {
+            text += format_entry(a.key, a.value, eol);
+        }
+        pieces.push_back(text);
+    };
+
+    while (rep != replaced.end() || ins != inserted.end()) {
+        if (ins != inserted.end() && (rep == replaced.end() || ins->first <= rep->first)) {
+            pieces.push_back(slice(pos, ins->first));
+            pos = ins->first;
+            if (!ins->second.empty()) {
+                render(ins->second);
+            }
+            ++ins;
+        } else {
+            pieces.push_back(slice(pos, rep->first));
+            pieces.push_back(rep->second.text);
+            pos = rep->second.end;
+            ++rep;
+        }
+    }
+    pieces.push_back(slice(pos, src.size()));
+
+    if (!appended.empty()) {
+        string& text = storage.emplace_back();
+        bool    lead = !src.empty();
+        if (open_end) {
+            text += eol;
+        }
+        for (const NewSection& s : appended) {
+            if (lead) {
+                text += eol;
+            }
+            lead = true;
+            text.append("[").append(s.name).append("]").append(eol);
+            for (const Added& a : s.entries) {
+                text += format_entry(a.key, a.value, eol);
+            }
+        }
+        pieces.push_back(text);
+    }
+}
+
+bool SyntaxTree::write(int fd) const {
+    vector<string_view> pieces;
+    vector<string>      storage;
+    gather(pieces, storage);
+
+    vector<iovec> iov;
+    iov.reserve(pieces.size());
+    for (string_view p : pieces) {
+        if (!p.empty()) {
+            iov.push_back(iovec { const_cast<char*>(p.data()), p.size() });
+        }
+    }
+
+    // writev may stop short; skip whatever went out and go again
+    size_t next = 0;
+    while (next < iov.size()) {
+        int     count = static_cast<int>(min<size_t>(iov.size() - next, IOV_MAX));
+        ssize_t n     = ::writev(fd, &iov[next], count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        size_t left = static_cast<size_t>(n);
+        while (next < iov.size() && left >= iov[next].iov_len) {
+            left -= iov[next].iov_len;
+            ++next;
+        }
+        if (left > 0) {
+            iov[next].iov_base = static_cast<char*>(iov[next].iov_base) + left;
+            iov[next].iov_len -= left;
+        }
+    }
+    return true;
+}
+
+string SyntaxTree::str() const {
+    vector<string_view> pieces;
+    vector<string>      storage;
+    gather(pieces, storage);
+
+    string out;
+    for (string_view p : pieces) {
+        out += p;
+    }
+    return out;
+}
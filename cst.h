@@ -0,0 +1,116 @@
+// Lossless concrete syntax tree for editing INI files in memory.
+//
+// A SyntaxTree keeps the source text and describes every line of it, blank
+// lines, comments and junk included, purely as byte ranges into that text.
+// Edits never touch the source: they are recorded as overlays (replaced
+// ranges, inserted entries and appended sections), and writing the tree out
+// is a gather of unchanged source slices and overlay text handed to writev.
+// Anything that was not edited comes out byte for byte as it went in.
+//
+// Targets follow the lookup rules: the first block of a section and the
+// first entry with the key.
+
+#pragma once
+
+#include "ini.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class SyntaxTree {
+public:
+    enum class Kind : uint8_t { Blank, Comment, Header, Entry, Other };
+
+    // One source line. All positions are offsets into the source text.
+    struct Line {
+        uint64_t begin       = 0; // start of the line
+        uint64_t end         = 0; // past its line break, if it has one
+        uint64_t room        = 0; // end of its content, before any '\r' or '\n'
+        uint64_t name_begin  = 0; // header name or entry key
+        uint64_t name_end    = 0;
+        uint64_t value_begin = 0; // entry value, inside any quotes
+        uint64_t value_end   = 0;
+        Kind     kind        = Kind::Blank;
+        bool     quoted      = false;
+    };
+
+    // Read and parse the file at path; returns false if it cannot be read
+    bool load(const std::filesystem::path& path);
+
+    // Parse INI text held in memory, dropping any previous edits
+    void parse(std::string text);
+
+    [[nodiscard]] const std::vector<Line>& lines() const noexcept { return source_lines; }
+    [[nodiscard]] std::string_view         slice(uint64_t begin, uint64_t end) const noexcept;
+
+    // Current value of key in section, edits included
+    [[nodiscard]] std::optional<std::string_view> get(std::string_view section, std::string_view key) const;
+
+    // Set key in section, adding it to the section if it is missing; false
+    // if there is no such section or fits_on_line() is false for the text
+    bool set(std::string_view section, std::string_view key, std::string_view value);
+
+    // Remove key from section; false if there is no such entry
+    bool remove(std::string_view section, std::string_view key);
+
+    // Append a new, empty section; false if it already exists or its name
+    // cannot be written (see fits_on_line())
+    bool add_section(std::string_view section);
+
+    // True once anything has been edited
+    [[nodiscard]] bool modified() const noexcept;
+
+    // Write the edited text to fd with writev; false on an I/O error. Hand
+    // it to replace_contents() (see editor.h) to replace the file.
+    bool write(int fd) const;
+
+    // The edited text as one string
+    [[nodiscard]] std::string str() const;
+
+private:
+    struct Replacement {
+        uint64_t    end;
+        std::string text;  // what is written in place of [begin, end)
+        std::string value; // the new value, for get(); empty for a deleted line
+        bool        deleted = false;
+    };
+
+    struct Added {
+        std::string key;
+        std::string value;
+    };
+
+    struct NewSection {
+        std::string        name;
+        std::vector<Added> entries;
+    };
+
+    // Lines [first, last) of a section's first block, after its header
+    struct Block {
+        size_t first;
+        size_t last;
+    };
+
+    [[nodiscard]] const Block* block(std::string_view section) const;
+    [[nodiscard]] const Line*  entry(const Block& b, std::string_view key) const;
+    [[nodiscard]] uint64_t     insertion_point(const Block& b) const;
+    [[nodiscard]] NewSection*  new_section(std::string_view section);
+
+    // Pieces of the output in order; storage holds the generated text they
+    // point into
+    void gather(std::vector<std::string_view>& pieces, std::vector<std::string>& storage) const;
+
+    std::string                                                src;
+    std::string                                                eol = "\n";
+    std::vector<Line>                                          source_lines;
+    std::unordered_map<std::string_view, Block, IHash, IEqual> blocks;
+    std::map<uint64_t, Replacement>                            replaced; // keyed by start offset
+    std::map<uint64_t, std::vector<Added>>                     inserted; // new entries at an offset
+    std::vector<NewSection>                                    appended;
+};
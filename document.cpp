@@ -0,0 +1,244 @@
+// In-memory document model for an INI file.
+
+#include "document.h"
+
+#include "allocstats.h"
+#include "convert.h"
+#include "probes.h"
+#include "trace.h"
+
+#include <bit>
+#include <fstream>
+
+using namespace std;
+
+namespace {
+
+// Typed values are cached as raw 64-bit patterns
+uint64_t encode(int64_t v) noexcept { return bit_cast<uint64_t>(v); }
+uint64_t encode(bool v) noexcept { return v ? 1 : 0; }
+uint64_t encode(double v) noexcept { return bit_cast<uint64_t>(v); }
+uint64_t encode(uint64_t v) noexcept { return v; }
+uint64_t encode(chrono::nanoseconds v) noexcept { return bit_cast<uint64_t>(static_cast<int64_t>(v.count())); }
+
+template <class T>
+T decode(uint64_t bits) noexcept;
+
+template <>
+int64_t decode<int64_t>(uint64_t bits) noexcept { return bit_cast<int64_t>(bits); }
+template <>
+bool decode<bool>(uint64_t bits) noexcept { return bits != 0; }
+template <>
+double decode<double>(uint64_t bits) noexcept { return bit_cast<double>(bits); }
+template <>
+uint64_t decode<uint64_t>(uint64_t bits) noexcept { return bits; }
+template <>
+chrono::nanoseconds decode<chrono::nanoseconds>(uint64_t bits) noexcept {
+    return chrono::nanoseconds(bit_cast<int64_t>(bits));
+}
+
+} // namespace
+
+// The first thread to convert a value claims the cache with a compare and
+// swap, fills in the bits and then publishes the kind. Anyone who finds the
+// slot busy or holding another kind just converts for themselves.
+template <class T>
+optional<T> ValueCache::get(Kind kind, optional<T> (*convert)(string_view) noexcept, string_view text) const noexcept {
+    uint8_t s = state.load(memory_order_acquire);
+    if ((s & ~failed) == kind) {
+        if (s & failed) {
+            return nullopt;
+        }
+        return decode<T>(bits.load(memory_order_relaxed));
+    }
+
+    optional<T> result   = convert(text);
+    uint8_t     expected = None;
+    if (s == None && state.compare_exchange_strong(expected, busy, memory_order_relaxed)) {
+        if (result) {
+            bits.store(encode(*result), memory_order_relaxed);
+        }
+        state.store(static_cast<uint8_t>(kind | (result ? 0 : failed)), memory_order_release);
+    }
+    return result;
+}
+
+// Read and parse the file at path; returns false if it cannot be read
+bool Document::load(const filesystem::path& path, Merge merge) {
+    ifstream file;
+    {
+        TraceScope trace("open");
+        file.open(path, ios::binary);
+    }
+    if (!file) {
+        return false;
+    }
+
+    string contents;
+    {
+        TraceScope trace("read");
+        AllocScope phase(AllocPhase::Reading);
+        char       block[64 * 1024];
+        while (file.read(block, sizeof(block)) || file.gcount() > 0) {
+            contents.append(block, static_cast<size_t>(file.gcount()));
+        }
+    }
+    if (file.bad()) {
+        return false;
+    }
+
+    parse(std::move(contents), merge);
+    return true;
+}
+
+// Parse INI text held in memory, replacing any previous contents. Follows
+// the same rules as the streaming scan in main(): comments, junk lines and
+// entries without a value are skipped, as is anything before the first
+// section header. Repeated sections and keys are resolved here, once, so
+// that lookups stay O(1) whatever the merge policy.
+void Document::parse(string contents, Merge merge) {
+    static atomic<uint64_t> parses {0};
+    TraceScope              trace("parse");
+    AllocScope              phase(AllocPhase::Parsing);
+
+    text   = std::move(contents);
+    number = parses.fetch_add(1, memory_order_relaxed) + 1;
+    INI_PROBE1(parse__start, text.size());
+    sections.clear();
+    section_ids.clear();
+    keys.clear();
+
+    Section*    current = nullptr;
+    Entry       entry;
+    string_view rest(text);
+    {
+        TraceScope scan("scan");
+        while (!rest.empty()) {
+            size_t      eol  = rest.find('\n');
+            string_view line = rest.substr(0, eol);
+            rest.remove_prefix(eol == string_view::npos ? rest.size() : eol + 1);
+
+            string_view trimmed = trim(line);
+            if (is_ignorable(trimmed)) {
+                continue;
+            }
+
+            if (is_header(trimmed)) {
+                string_view name = header_name(trimmed);
+                uint32_t    id   = section_ids.intern(name);
+                if (id == sections.size()) {
+                    sections.push_back(Section { name, {} });
+                    current = &sections.back();
+                } else {
+                    current = merge == Merge::None ? nullptr : &sections[id];
+                }
+                continue;
+            }
+
+            if (current && parse_section_entry(trimmed, entry) && entry.valid()) {
+                current->values.push_back(Value { entry.value(), {}, keys.intern(entry.name()) });
+            }
+        }
+    }
+
+    build_table(merge);
+    INI_PROBE2(parse__done, sections.size(), keys.size());
+}
+
+// Slot of (section, key), or the empty slot where it would go. The table is
+// a power of two in size and at most half full.
+size_t Document::probe(uint32_t section, uint32_t key) const noexcept {
+    const size_t mask = table.size() - 1;
+    uint64_t     h    = ((static_cast<uint64_t>(section) << 32) | key) * 0x9E3779B97F4A7C15ull;
+    for (size_t i = static_cast<size_t>(h >> 32) & mask;; i = (i + 1) & mask) {
+        const Slot& slot = table[i];
+        if (slot.section == UINT32_MAX || (slot.section == section && slot.key == key)) {
+            return i;
+        }
+    }
+}
+
+void Document::build_table(Merge merge) {
+    TraceScope trace("index");
+    size_t count = 0;
+    for (const Section& sec : sections) {
+        count += sec.values.size();
+    }
+    size_t capacity = 16;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    table.assign(capacity, Slot {});
+
+    for (uint32_t s = 0; s < sections.size(); ++s) {
+        const vector<Value>& values = sections[s].values;
+        for (uint32_t i = 0; i < values.size(); ++i) {
+            Slot& slot = table[probe(s, values[i].key)];
+            if (slot.section == UINT32_MAX || merge == Merge::LastWins) {
+                slot = Slot { s, values[i].key, i };
+            }
+        }
+    }
+}
+
+bool Document::has_section(string_view section) const noexcept {
+    return section_ids.find(section) != KeyPool::npos;
+}
+
+const Document::Value* Document::find(string_view section, string_view key) const noexcept {
+    return find(section, ihash(section), key, ihash(key));
+}
+
+const Document::Value* Document::find(string_view section, uint64_t section_hash, string_view key,
+                                      uint64_t key_hash) const noexcept {
+    uint32_t sid = section_ids.find(section, section_hash);
+    if (sid == KeyPool::npos) {
+        return nullptr;
+    }
+    uint32_t id = keys.find(key, key_hash);
+    if (id == KeyPool::npos) {
+        return nullptr;
+    }
+    const Slot& slot = table[probe(sid, id)];
+    return slot.section == UINT32_MAX ? nullptr : &sections[slot.section].values[slot.value];
+}
+
+optional<string_view> Document::get(string_view section, string_view key) const noexcept {
+    if (const Value* v = find(section, key)) {
+        return v->text;
+    }
+    return nullopt;
+}
+
+optional<string_view> Document::get(string_view section, uint64_t section_hash, string_view key,
+                                    uint64_t key_hash) const noexcept {
+    if (const Value* v = find(section, section_hash, key, key_hash)) {
+        return v->text;
+    }
+    return nullopt;
+}
+
+optional<int64_t> Document::get_int(string_view section, string_view key) const noexcept {
+    const Value* v = find(section, key);
+    return v ? v->cache.get(ValueCache::Int, to_int, v->text) : nullopt;
+}
+
+optional<bool> Document::get_bool(string_view section, string_view key) const noexcept {
+    const Value* v = find(section, key);
+    return v ? v->cache.get(ValueCache::Bool, to_bool, v->text) : nullopt;
+}
+
+optional<double> Document::get_double(string_view section, string_view key) const noexcept {
+    const Value* v = find(section, key);
+    return v ? v->cache.get(ValueCache::Double, to_double, v->text) : nullopt;
+}
+
+optional<uint64_t> Document::get_size(string_view section, string_view key) const noexcept {
+    const Value* v = find(section, key);
+    return v ? v->cache.get(ValueCache::Size, to_size, v->text) : nullopt;
+}
+
+optional<chrono::nanoseconds> Document::get_duration(string_view section, string_view key) const noexcept {
+    const Value* v = find(section, key);
+    return v ? v->cache.get(ValueCache::Duration, to_duration, v->text) : nullopt;
+}
@@ -0,0 +1,130 @@
+// In-memory document model for an INI file.
+//
+// A Document owns the file text and indexes its sections; names and values
+// are views into that text. Once built a document is immutable, apart from
+// the per-value conversion caches, which are lock-free, so it can be read
+// from many threads at once.
+
+#pragma once
+
+#include "ini.h"
+#include "keypool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Caches the first typed conversion made on a value, so repeated typed reads
+// of the same key cost a couple of loads instead of a parse. Conversions to
+// a different type than the cached one are simply recomputed.
+class ValueCache {
+public:
+    enum Kind : uint8_t { None, Int, Bool, Double, Duration, Size };
+
+    ValueCache() = default;
+    ValueCache(const ValueCache& other) noexcept
+        : state(other.state.load(std::memory_order_relaxed))
+        , bits(other.bits.load(std::memory_order_relaxed)) { }
+
+    // Return the cached result of converting text to kind, running convert
+    // and publishing its result if nothing has been cached yet
+    template <class T>
+    [[nodiscard]] std::optional<T> get(Kind kind, std::optional<T> (*convert)(std::string_view) noexcept,
+                                       std::string_view text) const noexcept;
+
+private:
+    static constexpr uint8_t failed = 0x08;
+    static constexpr uint8_t busy   = 0x80;
+
+    mutable std::atomic<uint8_t>  state {None};
+    mutable std::atomic<uint64_t> bits {0};
+};
+
+// How a document treats a section that appears more than once in a file
+enum class Merge : uint8_t {
+    None,      // only the first block counts, like the streaming scan
+    FirstWins, // all blocks are merged; the first occurrence of a key wins
+    LastWins,  // all blocks are merged; the last occurrence of a key wins
+};
+
+class Document {
+public:
+    Document()                           = default;
+    Document(const Document&)            = delete;
+    Document& operator=(const Document&) = delete;
+
+    // Read and parse the file at path; returns false if it cannot be read
+    bool load(const std::filesystem::path& path, Merge merge = Merge::None);
+
+    // Parse INI text held in memory, replacing any previous contents
+    void parse(std::string text, Merge merge = Merge::None);
+
+    [[nodiscard]] bool   has_section(std::string_view section) const noexcept;
+    [[nodiscard]] size_t section_count() const noexcept { return sections.size(); }
+
+    // Raw value of key in section, as a view into the document text
+    [[nodiscard]] std::optional<std::string_view> get(std::string_view section, std::string_view key) const noexcept;
+
+    // As above, for callers that carry names with their ihash() already
+    // computed. The names are still compared, so a wrong hash only misses.
+    [[nodiscard]] std::optional<std::string_view> get(std::string_view section, uint64_t section_hash,
+                                                      std::string_view key, uint64_t key_hash) const noexcept;
+
+    // Typed accessors; nullopt if the key is missing or does not convert
+    [[nodiscard]] std::optional<int64_t>  get_int(std::string_view section, std::string_view key) const noexcept;
+    [[nodiscard]] std::optional<bool>     get_bool(std::string_view section, std::string_view key) const noexcept;
+    [[nodiscard]] std::optional<double>   get_double(std::string_view section, std::string_view key) const noexcept;
+    [[nodiscard]] std::optional<uint64_t> get_size(std::string_view section, std::string_view key) const noexcept;
+    [[nodiscard]] std::optional<std::chrono::nanoseconds> get_duration(std::string_view section,
+                                                                       std::string_view key) const noexcept;
+
+    // Number of distinct key names across all sections
+    [[nodiscard]] size_t key_count() const noexcept { return keys.size(); }
+
+    // Bytes of INI text the document holds
+    [[nodiscard]] size_t text_bytes() const noexcept { return text.size(); }
+
+    // Process-wide unique number of the contents; every parse gets a new
+    // one, so caches can tell documents apart even at a reused address
+    [[nodiscard]] uint64_t serial() const noexcept { return number; }
+
+private:
+    struct Value {
+        std::string_view text;
+        ValueCache       cache;
+        uint32_t         key; // id in keys
+    };
+
+    // Every block of a section lands in one Section
+    struct Section {
+        std::string_view   name;
+        std::vector<Value> values;
+    };
+
+    // Slot of the (section, key) -> value table. The table holds only the
+    // value that won under the document's Merge policy, so a lookup is one
+    // probe sequence of integer compares.
+    struct Slot {
+        uint32_t section = UINT32_MAX; // UINT32_MAX marks an empty slot
+        uint32_t key     = 0;
+        uint32_t value   = 0;
+    };
+
+    void                       build_table(Merge merge);
+    [[nodiscard]] size_t       probe(uint32_t section, uint32_t key) const noexcept;
+    [[nodiscard]] const Value* find(std::string_view section, std::string_view key) const noexcept;
+    [[nodiscard]] const Value* find(std::string_view section, uint64_t section_hash, std::string_view key,
+                                    uint64_t key_hash) const noexcept;
+
+    std::string          text;
+    uint64_t             number = 0;
+    std::vector<Section> sections;
+    KeyPool              section_ids; // id == index into sections
+    KeyPool              keys;
+    std::vector<Slot>    table;
+};
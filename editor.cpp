@@ -0,0 +1,537 @@
+// In-place editing of INI files.
+
+#include "editor.h"
+
+#include "ini.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <fcntl.h>
+#include <fstream>
+#include <istream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+// Closes a descriptor on every return path
+struct Fd {
+    int fd = -1;
+    explicit Fd(int f) noexcept
+        : fd(f) { }
+    ~Fd() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+    Fd(const Fd&)            = delete;
+    Fd& operator=(const Fd&) = delete;
+};
+
+bool write_all(int fd, const char* buf, size_t n) {
+    while (n > 0) {
+        ssize_t w = ::write(fd, buf, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += w;
+        n -= static_cast<size_t>(w);
+    }
+    return true;
+}
+
+bool pwrite_all(int fd, const char* buf, size_t n, uint64_t off) {
+    while (n > 0) {
+        ssize_t w = ::pwrite(fd, buf, n, static_cast<off_t>(off));
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += w;
+        n -= static_cast<size_t>(w);
+        off += static_cast<uint64_t>(w);
+    }
+    return true;
+}
+
+// Copy len bytes at off in one file to the current position of another.
+// copy_file_range lets the kernel (or the filesystem, with reflinks) move
+// the data without it passing through userspace; where it is unsupported
+// the copy falls back to pread and write.
+bool splice_range(int in, uint64_t off, uint64_t len, int out) {
+    loff_t pos = static_cast<loff_t>(off);
+    while (len > 0) {
+        ssize_t n = ::copy_file_range(in, &pos, out, nullptr, len, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n < 0 && errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+                return false;
+            }
+            break;
+        }
+        len -= static_cast<uint64_t>(n);
+    }
+
+    char buf[64 * 1024];
+    while (len > 0) {
+        ssize_t n = ::pread(in, buf, min<uint64_t>(len, sizeof(buf)), pos);
+        if (n <= 0) {
+            if (n == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        if (!write_all(out, buf, static_cast<size_t>(n))) {
+            return false;
+        }
+        pos += n;
+        len -= static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+// Flush the directory holding path, so that a rename into it survives a
+// crash
+bool sync_directory(const filesystem::path& path) {
+    filesystem::path dir = path.parent_path();
+    Fd               fd(::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    return fd.fd >= 0 && ::fsync(fd.fd) == 0;
+}
+
+// Replace [begin, end) of the original with text; begin == end inserts
+struct Patch {
+    uint64_t begin;
+    uint64_t end;
+    string   text;
+};
+
+// Write the original with patches applied, which must be sorted and must
+// not overlap, over path. Unchanged ranges are spliced rather than copied
+// through userspace.
+bool replace_file(const filesystem::path& path, int in, uint64_t size, const vector<Patch>& patches) {
+    return replace_contents(path, [&](int out) {
+        uint64_t pos = 0;
+        for (const Patch& p : patches) {
+            if (!splice_range(in, pos, p.begin - pos, out) || !write_all(out, p.text.data(), p.text.size())) {
+                return false;
+            }
+            pos = p.end;
+        }
+        return splice_range(in, pos, size - pos, out);
+    });
+}
+
+// Text that replaces [span.begin, span.room) so the entry reads back as
+// value. Inside existing quotes only the closing quote has to be restored.
+string value_slot(const ValueSpan& span, string_view value) {
+    if (span.quoted) {
+        return string(value) + '"';
+    }
+    if (needs_quotes(value)) {
+        return '"' + string(value) + '"';
+    }
+    return string(value);
+}
+
+// Value span of the entry parsed from line, which starts at offset
+ValueSpan span_of(const string& line, string_view trimmed, const Entry& entry, uint64_t offset) {
+    string_view v    = entry.value();
+    size_t      room = line.size() - (line.ends_with('\r') ? 1 : 0);
+
+    ValueSpan   span;
+    span.begin  = offset + static_cast<uint64_t>(v.data() - line.data());
+    span.end    = span.begin + v.size();
+    span.room   = offset + room;
+    span.quoted = v.data() + v.size() < trimmed.data() + trimmed.size();
+    return span;
+}
+
+} // namespace
+
+optional<ValueSpan> locate_value(const filesystem::path& path, string_view section, string_view key) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        return nullopt;
+    }
+
+    string   line;
+    bool     in_section = false;
+    Entry    entry;
+    uint64_t offset = 0;
+
+    for (; getline(file, line); offset += line.size() + 1) {
+        string_view trimmed = trim(line);
+        if (is_ignorable(trimmed)) {
+            continue;
+        }
+
+        if (is_header(trimmed)) {
+            if (in_section) {
+                break;
+            }
+            in_section = is_section(trimmed, section);
+            continue;
+        }
+
+        if (in_section && parse_section_entry(trimmed, entry) && entry.valid() && iequals(entry.name(), key)) {
+            return span_of(line, trimmed, entry, offset);
+        }
+    }
+    return nullopt;
+}
+
+SetResult set_value(const filesystem::path& path, string_view section, string_view key, string_view value) {
+    if (!fits_on_line(section, key, value)) {
+        errno = EINVAL;
+        return SetResult::Failed;
+    }
+    Fd fd(::open(path.c_str(), O_RDWR | O_CLOEXEC));
+    if (fd.fd < 0) {
+        return SetResult::Failed;
+    }
+
+    auto span = locate_value(path, section, key);
+    if (!span) {
+        return SetResult::NotFound;
+    }
+
+    string         slot = value_slot(*span, value);
+    const uint64_t room = span->room - span->begin;
+    if (slot.size() <= room) {
+        slot.resize(room, ' ');
+        return pwrite_all(fd.fd, slot.data(), slot.size(), span->begin) ? SetResult::Patched : SetResult::Failed;
+    }
+
+    struct stat st;
+    if (::fstat(fd.fd, &st) != 0) {
+        return SetResult::Failed;
+    }
+    vector<Patch> patches { Patch { span->begin, span->room, std::move(slot) } };
+    return replace_file(path, fd.fd, static_cast<uint64_t>(st.st_size), patches) ? SetResult::Rewritten
+                                                                                  : SetResult::Failed;
+}
+
+const char* status_name(Edit::Status status) noexcept {
+    switch (status) {
+    case Edit::Pending:
+        return "pending";
+    case Edit::Updated:
+        return "updated";
+    case Edit::Added:
+        return "added";
+    case Edit::Deleted:
+        return "deleted";
+    case Edit::Created:
+        return "created";
+    case Edit::Exists:
+        return "exists";
+    case Edit::NotFound:
+        return "not found";
+    case Edit::Superseded:
+        return "superseded";
+    }
+    return "unknown";
+}
+
+namespace {
+
+// The effective edits aimed at one section
+struct SectionPlan {
+    vector<Edit*> keys;           // set and delete, one per key
+    Edit*         add  = nullptr; // add-section
+    bool          seen = false;   // its first block has been scanned
+};
+
+} // namespace
+
+bool parse_edit(string_view line, Edit& edit, string& error) {
+    string_view rest = trim(line);
+    string_view op   = next_token(rest);
+    edit.section     = next_token(rest);
+    edit.key.clear();
+    edit.value.clear();
+    edit.status = Edit::Pending;
+
+    bool ok = !edit.section.empty();
+    if (op == "set") {
+        edit.op    = Edit::Set;
+        edit.key   = next_token(rest);
+        edit.value = unquote(trim(rest));
+        ok         = ok && !edit.key.empty() && !edit.value.empty();
+    } else if (op == "delete") {
+        edit.op  = Edit::Delete;
+        edit.key = next_token(rest);
+        ok       = ok && !edit.key.empty() && trim(rest).empty();
+    } else if (op == "add-section") {
+        edit.op = Edit::AddSection;
+        ok      = ok && trim(rest).empty();
+    } else {
+        error = "unknown operation \"" + string(op) + "\"";
+        return false;
+    }
+
+    if (!ok) {
+        error = "malformed " + string(op);
+    }
+    return ok;
+}
+
+bool parse_edit_script(istream& in, vector<Edit>& edits, string& error) {
+    string line;
+    for (size_t number = 1; getline(in, line); ++number) {
+        if (is_ignorable(trim(line))) {
+            continue;
+        }
+
+        Edit edit;
+        if (!parse_edit(line, edit, error)) {
+            error = "line " + to_string(number) + ": " + error;
+            return false;
+        }
+        edit.line = number;
+        edits.push_back(std::move(edit));
+    }
+    return true;
+}
+
+// Sections always go in brackets and keys only when they contain blanks,
+// so that parse_edit() reads the line back exactly
+string format_edit(const Edit& edit) {
+    auto token = [](string_view name) {
+        bool blank = any_of(name.begin(), name.end(), [](unsigned char c) { return isspace(c); });
+        return blank ? "[" + string(name) + "]" : string(name);
+    };
+
+    string line;
+    switch (edit.op) {
+    case Edit::Set:
+        line = "set [" + edit.section + "] " + token(edit.key) + " ";
+        line += needs_quotes(edit.value) ? '"' + edit.value + '"' : edit.value;
+        break;
+    case Edit::Delete:
+        line = "delete [" + edit.section + "] " + token(edit.key);
+        break;
+    case Edit::AddSection:
+        line = "add-section [" + edit.section + "]";
+        break;
+    }
+    return line + "\n";
+}
+
+// The scan mirrors locate_value(), but with every targeted section in play
+// at once. Edits become patches against the original byte offsets, and the
+// file is written once at the end through replace_contents().
+bool apply_edits(const filesystem::path& path, vector<Edit>& edits) {
+    for (const Edit& e : edits) {
+        if (!fits_on_line(e.section, e.key, e.value)) {
+            errno = EINVAL;
+            return false;
+        }
+    }
+    Fd fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd.fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd.fd, &st) != 0) {
+        return false;
+    }
+    const uint64_t size = static_cast<uint64_t>(st.st_size);
+
+    // Later edits of the same key or section supersede earlier ones
+    unordered_map<string, SectionPlan, IHash, IEqual> plans;
+    for (Edit& edit : edits) {
+        edit.status       = Edit::Pending;
+        SectionPlan& plan = plans[edit.section];
+        if (edit.op == Edit::AddSection) {
+            if (plan.add) {
+                plan.add->status = Edit::Superseded;
+            }
+            plan.add = &edit;
+            continue;
+        }
+        auto same = find_if(plan.keys.begin(), plan.keys.end(), [&](Edit* e) { return iequals(e->key, edit.key); });
+        if (same != plan.keys.end()) {
+            (*same)->status = Edit::Superseded;
+            *same           = &edit;
+        } else {
+            plan.keys.push_back(&edit);
+        }
+    }
+
+    ifstream file(path, ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    vector<Patch> patches;
+    string        eol        = "\n";
+    bool          first_line = true;
+    bool          terminated = true;    // the last line read ended with a newline
+    SectionPlan*  active     = nullptr; // plan for the block being scanned, if any
+    uint64_t      insert_at  = 0;       // where keys missing from the active block go
+    string        line;
+    Entry         entry;
+
+    // Keys still pending when the active block ends are added after its
+    // last non-blank line
+    auto close_block = [&] {
+        if (!active) {
+            return;
+        }
+        string text;
+        for (Edit* e : active->keys) {
+            if (e->op == Edit::Set && e->status == Edit::Pending) {
+                text += format_entry(e->key, e->value, eol);
+                e->status = Edit::Added;
+            }
+        }
+        if (!text.empty()) {
+            if (insert_at == size && !terminated) {
+                text.insert(0, eol);
+                terminated = true;
+            }
+            patches.push_back(Patch { insert_at, insert_at, std::move(text) });
+        }
+        active = nullptr;
+    };
+
+    for (uint64_t offset = 0; getline(file, line); offset += line.size() + 1) {
+        if (first_line && line.ends_with('\r')) {
+            eol = "\r\n";
+        }
+        first_line = false;
+        terminated = offset + line.size() < size;
+
+        const uint64_t next    = terminated ? offset + line.size() + 1 : size;
+        string_view    trimmed = trim(line);
+        if (is_ignorable(trimmed)) {
+            continue;
+        }
+
+        if (is_header(trimmed)) {
+            close_block();
+            auto it = plans.find(header_name(trimmed));
+            if (it != plans.end() && !it->second.seen) {
+                it->second.seen = true;
+                active          = &it->second;
+                insert_at       = next;
+            }
+            continue;
+        }
+
+        if (!active) {
+            continue;
+        }
+        insert_at = next;
+        if (!parse_section_entry(trimmed, entry) || !entry.valid()) {
+            continue;
+        }
+
+        for (Edit* e : active->keys) {
+            if (e->status != Edit::Pending || !iequals(e->key, entry.name())) {
+                continue;
+            }
+            if (e->op == Edit::Set) {
+                ValueSpan span = span_of(line, trimmed, entry, offset);
+                patches.push_back(Patch { span.begin, span.room, value_slot(span, e->value) });
+                e->status = Edit::Updated;
+            } else {
+                patches.push_back(Patch { offset, next, {} });
+                e->status = Edit::Deleted;
+            }
+            break;
+        }
+    }
+    if (file.bad()) {
+        return false;
+    }
+    close_block();
+
+    // Sections that were never seen: create them if asked to, in script
+    // order, and fail everything else aimed at them
+    string appended;
+    for (Edit& edit : edits) {
+        if (edit.op != Edit::AddSection || edit.status != Edit::Pending) {
+            continue;
+        }
+        SectionPlan& plan = plans.find(edit.section)->second;
+        if (plan.seen) {
+            edit.status = Edit::Exists;
+            continue;
+        }
+        appended += eol + "[" + edit.section + "]" + eol;
+        for (Edit* e : plan.keys) {
+            if (e->op == Edit::Set) {
+                appended += format_entry(e->key, e->value, eol);
+                e->status = Edit::Added;
+            }
+        }
+        edit.status = Edit::Created;
+    }
+    for (Edit& edit : edits) {
+        if (edit.status == Edit::Pending) {
+            edit.status = Edit::NotFound;
+        }
+    }
+
+    if (!appended.empty()) {
+        if (size > 0 && !terminated) {
+            appended.insert(0, eol);
+        } else if (size == 0) {
+            appended.erase(0, eol.size());
+        }
+        patches.push_back(Patch { size, size, std::move(appended) });
+    }
+    if (patches.empty()) {
+        return true;
+    }
+
+    stable_sort(patches.begin(), patches.end(), [](const Patch& a, const Patch& b) { return a.begin < b.begin; });
+    return replace_file(path, fd.fd, size, patches);
+}
+
+// The original is never modified, so a crash leaves either the old file or
+// the new one
+bool replace_contents(const filesystem::path& path, const function<bool(int fd)>& write) {
+    // A file that does not exist yet is created 0644 and owned by the caller
+    struct stat st;
+    const bool  exists = ::stat(path.c_str(), &st) == 0;
+    if (!exists && errno != ENOENT) {
+        return false;
+    }
+    if (!exists) {
+        st.st_mode = 0644;
+    }
+
+    string tmp = path.string() + ".XXXXXX";
+    Fd     out(::mkstemp(tmp.data()));
+    if (out.fd < 0) {
+        return false;
+    }
+
+    // Only root may give a file away; others keep the file as their own
+    if (exists && ::fchown(out.fd, st.st_uid, st.st_gid) != 0) {
+        errno = 0;
+    }
+    bool ok = ::fchmod(out.fd, st.st_mode & 07777) == 0 && write(out.fd) && ::fsync(out.fd) == 0;
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+        int saved = errno;
+        ::unlink(tmp.c_str());
+        errno = saved;
+        return false;
+    }
+    return sync_directory(path);
+}
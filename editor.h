@@ -0,0 +1,105 @@
+// In-place editing of INI files.
+//
+// Edits find their target with the same rules as the streaming lookup in
+// main(): the first block of the section, the first entry with the key.
+// Everything outside the bytes being replaced is preserved exactly.
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Where an entry's value sits in a file. [begin, end) is the value itself,
+// inside any quotes; room is where the line's content ends, after the
+// closing quote and any trailing blanks but before the line break.
+struct ValueSpan {
+    uint64_t begin  = 0;
+    uint64_t end    = 0;
+    uint64_t room   = 0;
+    bool     quoted = false;
+};
+
+// Find the value of key in section the way the streaming lookup would
+[[nodiscard]] std::optional<ValueSpan> locate_value(const std::filesystem::path& path, std::string_view section,
+                                                    std::string_view key);
+
+enum class SetResult {
+    Patched,   // the new value fit in the old slot and was written in place
+    Rewritten, // the file was rebuilt around the new value and renamed over
+    NotFound,  // no such entry; the file is untouched
+    Failed,    // I/O error, errno is set; the file is untouched
+};
+
+// Replace the value of key in section. A value that fits in the old slot is
+// patched in place, padded with blanks that the parser trims. Otherwise a
+// new file is assembled next to the old one by splicing the unchanged
+// prefix and suffix with copy_file_range and renamed over it atomically.
+// Text that would break its line (see fits_on_line()) fails with EINVAL.
+SetResult set_value(const std::filesystem::path& path, std::string_view section, std::string_view key,
+                    std::string_view value);
+
+// One operation of a bulk edit script. Scripts have one operation per line;
+// blank lines and lines starting with ';' or '#' are ignored:
+//
+//     set <section> <key> <value>
+//     delete <section> <key>
+//     add-section <section>
+//
+// The value is the rest of the line, trimmed and unquoted like a value in
+// an INI file. A section or key name containing blanks can be written in
+// brackets: set [my section] key value.
+struct Edit {
+    enum Op { Set, Delete, AddSection };
+    enum Status {
+        Pending,
+        Updated,    // set replaced an existing value
+        Added,      // set added a key that did not exist
+        Deleted,    // delete removed the entry
+        Created,    // add-section appended a new section
+        Exists,     // add-section named a section that is already there
+        NotFound,   // no section or entry to apply the edit to
+        Superseded, // a later edit of the same key took precedence
+    };
+
+    Op          op;
+    std::string section;
+    std::string key;
+    std::string value;
+    size_t      line   = 0; // line in the script, for reporting
+    Status      status = Pending;
+};
+
+[[nodiscard]] const char* status_name(Edit::Status status) noexcept;
+
+// Parse one script line that is not blank or a comment; on a malformed
+// line returns false and describes the problem in error
+bool parse_edit(std::string_view line, Edit& edit, std::string& error);
+
+// Parse an edit script; on a malformed line returns false and describes
+// the problem in error
+bool parse_edit_script(std::istream& in, std::vector<Edit>& edits, std::string& error);
+
+// One script line, newline included, that parse_edit() turns back into edit
+[[nodiscard]] std::string format_edit(const Edit& edit);
+
+// Apply edits in a single streaming pass over the file and replace it
+// atomically, filling in each edit's status. Targets follow the lookup
+// rules: the first block of a section and the first entry with a key. When
+// a script touches the same key twice, the later edit wins. Keys that are
+// set but missing are added at the end of the section's first block, and
+// new sections at the end of the file. Returns false on an I/O error, with
+// errno set and the file untouched; an edit whose text would break its
+// line (see fits_on_line()) fails the whole script with EINVAL.
+bool apply_edits(const std::filesystem::path& path, std::vector<Edit>& edits);
+
+// Replace path atomically with what write() puts into the descriptor it is
+// given: a temporary in the same directory, which is flushed and renamed
+// over path, keeping its mode and, where the caller may give it, its owner;
+// a path that does not exist yet is created 0644. Returns false on an I/O error, with errno set and the file untouched.
+bool replace_contents(const std::filesystem::path& path, const std::function<bool(int fd)>& write);
@@ -0,0 +1,147 @@
+// Line-level parsing primitives shared by the inireader command line program
+// and the document library.
+
+#include "ini.h"
+
+#include "allocstats.h"
+
+#include <algorithm>
+#include <cctype>
+
+using namespace std;
+
+// Case-insensitive string comparison
+bool iequals(string_view a, string_view b) noexcept {
+    return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y) {
+               return tolower(x) == tolower(y);
+           });
+}
+
+// Case-insensitive FNV-1a hash, consistent with iequals()
+uint64_t ihash(string_view sv) noexcept {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : sv) {
+        h ^= static_cast<uint64_t>(tolower(c));
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Trim leading/trailing whitespace
+string_view trim(string_view sv) noexcept {
+    AllocScope phase(AllocPhase::Trimming);
+    auto is_not_space = [](unsigned char c) { return !isspace(c); };
+    auto start        = find_if(sv.begin(), sv.end(), is_not_space);
+    auto end          = find_if(sv.rbegin(), sv.rend(), is_not_space).base();
+    return (start < end) ? string_view(&*start, static_cast<size_t>(end - start)) : string_view {};
+}
+
+// Remove surrounding quotes if present
+string_view unquote(string_view sv) noexcept {
+    AllocScope phase(AllocPhase::Trimming);
+    if (sv.size() >= 2 && sv.front() == '"' && sv.back() == '"') {
+        sv.remove_prefix(1);
+        sv.remove_suffix(1);
+    }
+    return sv;
+}
+
+// True for blank lines and ';' or '#' comments
+bool is_ignorable(string_view trimmed) noexcept {
+    return trimmed.empty() || trimmed.front() == ';' || trimmed.front() == '#';
+}
+
+// True if the trimmed line looks like a [Section] header
+bool is_header(string_view trimmed) noexcept {
+    return trimmed.size() >= 2 && trimmed.front() == '[' && trimmed.back() == ']';
+}
+
+// Name inside a [Section] header, trimmed
+string_view header_name(string_view trimmed) noexcept {
+    AllocScope phase(AllocPhase::Parsing);
+    return trim(trimmed.substr(1, trimmed.size() - 2));
+}
+
+// Parse a line as a key=value entry; returns true if successful
+bool parse_section_entry(string_view line, Entry& e) {
+    AllocScope phase(AllocPhase::Parsing);
+    e.clear();
+    string_view trimmed = trim(line);
+    if (trimmed.empty()) {
+        return false;
+    }
+
+    if (auto pos = trimmed.find('='); pos != string_view::npos) {
+        string_view name  = trim(trimmed.substr(0, pos));
+        string_view value = unquote(trim(trimmed.substr(pos + 1)));
+
+        if (!name.empty()) {
+            e = Entry { name, value };
+            return true;
+        }
+    }
+    return false;
+}
+
+// Check if a line represents the desired section header [Section]
+bool is_section(string_view line, string_view section_name) {
+    AllocScope phase(AllocPhase::Parsing);
+    if (line.size() < 3 || line.front() != '[' || line.back() != ']') {
+        return false;
+    }
+
+    return iequals(header_name(line), section_name);
+}
+
+// Next blank-separated token; a bracketed token may contain blanks
+string_view next_token(string_view& rest) noexcept {
+    rest = trim(rest);
+    if (rest.empty()) {
+        return {};
+    }
+
+    size_t end;
+    if (rest.front() == '[') {
+        end = rest.find(']');
+        if (end == string_view::npos) {
+            return {};
+        }
+        string_view token = trim(rest.substr(1, end - 1));
+        rest.remove_prefix(end + 1);
+        return token;
+    }
+
+    end = 0;
+    while (end < rest.size() && !isspace(static_cast<unsigned char>(rest[end]))) {
+        ++end;
+    }
+    string_view token = rest.substr(0, end);
+    rest.remove_prefix(end);
+    return token;
+}
+
+// True if value would not read back unchanged when written bare
+bool needs_quotes(string_view value) noexcept {
+    return value.empty() || isspace(static_cast<unsigned char>(value.front()))
+           || isspace(static_cast<unsigned char>(value.back()))
+           || (value.size() >= 2 && value.front() == '"' && value.back() == '"');
+}
+
+// A complete "key = value" line ending in eol
+string format_entry(string_view key, string_view value, string_view eol) {
+    string line;
+    line.reserve(key.size() + value.size() + eol.size() + 5);
+    line.append(key).append(" = ");
+    if (needs_quotes(value)) {
+        line.append("\"").append(value).append("\"");
+    } else {
+        line.append(value);
+    }
+    line.append(eol);
+    return line;
+}
+
+bool fits_on_line(string_view section, string_view key, string_view value) noexcept {
+    return section.find_first_of("\r\n]") == string_view::npos && key.find_first_of("\r\n") == string_view::npos
+           && value.find_first_of("\r\n") == string_view::npos;
+}
@@ -0,0 +1,98 @@
+// Line-level parsing primitives shared by the inireader command line program
+// and the document library.
+//
+// Everything here works on views into a caller owned buffer, so scanning a
+// file line by line does not allocate.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Represents a name-value pair parsed from an INI file line. The name and
+// value are views into the line that was parsed.
+class Entry {
+public:
+    Entry() = default;
+    Entry(std::string_view name, std::string_view value)
+        : n(name)
+        , v(value) { }
+
+    [[nodiscard]] bool valid() const noexcept {
+        return !n.empty() && !v.empty();
+    }
+
+    void clear() noexcept {
+        n = {};
+        v = {};
+    }
+
+    [[nodiscard]] std::string_view name() const noexcept { return n; }
+    [[nodiscard]] std::string_view value() const noexcept { return v; }
+
+    friend bool                    parse_section_entry(std::string_view line, Entry& e);
+
+private:
+    std::string_view n;
+    std::string_view v;
+};
+
+// Case-insensitive string comparison
+[[nodiscard]] bool iequals(std::string_view a, std::string_view b) noexcept;
+
+// Case-insensitive FNV-1a hash, consistent with iequals()
+[[nodiscard]] uint64_t ihash(std::string_view sv) noexcept;
+
+// Trim leading/trailing whitespace
+[[nodiscard]] std::string_view trim(std::string_view sv) noexcept;
+
+// Remove surrounding quotes if present
+[[nodiscard]] std::string_view unquote(std::string_view sv) noexcept;
+
+// True for lines that carry nothing: blank lines and ';' or '#' comments.
+// The line must already be trimmed.
+[[nodiscard]] bool is_ignorable(std::string_view trimmed) noexcept;
+
+// True if the trimmed line looks like a [Section] header
+[[nodiscard]] bool is_header(std::string_view trimmed) noexcept;
+
+// Name inside a [Section] header, trimmed; the line must satisfy is_header()
+[[nodiscard]] std::string_view header_name(std::string_view trimmed) noexcept;
+
+// Parse a line as a key=value entry; returns true if successful
+bool parse_section_entry(std::string_view line, Entry& e);
+
+// Check if a line represents the desired section header [Section]
+[[nodiscard]] bool is_section(std::string_view line, std::string_view section_name);
+
+// Take the next blank-separated token off the front of rest. A token
+// starting with '[' runs to the matching ']', may contain blanks and is
+// returned without its brackets. Empty when rest holds no more tokens or
+// the bracket is not closed.
+[[nodiscard]] std::string_view next_token(std::string_view& rest) noexcept;
+
+// True if value would not read back unchanged when written bare, because
+// the parser would trim it or strip its quotes
+[[nodiscard]] bool needs_quotes(std::string_view value) noexcept;
+
+// A complete "key = value" line ending in eol, quoting value if needed
+[[nodiscard]] std::string format_entry(std::string_view key, std::string_view value, std::string_view eol);
+
+// True if section, key and value can be written into a file as they are:
+// none holds a line break, which would start a line of its own, and the
+// section holds no ']', which would end its header early
+[[nodiscard]] bool fits_on_line(std::string_view section, std::string_view key, std::string_view value) noexcept;
+
+// Hash and equality functors for case-insensitive unordered containers.
+// Both are transparent, so containers keyed by std::string can be probed
+// with a std::string_view.
+struct IHash {
+    using is_transparent = void;
+    [[nodiscard]] size_t operator()(std::string_view sv) const noexcept { return static_cast<size_t>(ihash(sv)); }
+};
+
+struct IEqual {
+    using is_transparent = void;
+    [[nodiscard]] bool operator()(std::string_view a, std::string_view b) const noexcept { return iequals(a, b); }
+};
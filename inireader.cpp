@@ -1,7 +1,7 @@
 // This command line program just reads a named value from a section in an ini
 // file.
 //
-// usage: inireader <path-to-ini-file>  <section-name>  <value-name>
+// usage: inireader [options] <path-to-ini-file>  <section-name>  <value-name>
 //
 // For example, if the ini file was as shown here:
 //
@@ -26,141 +26,801 @@
 // $ inireader sample.ini  CLIENT  PHONE
 //
 // The phone number would be printed on the terminal
+//
+// With --type=int|bool|double|duration|size the value is converted before it
+// is printed, and the exit status is 4 if it does not convert. Durations are
+// printed in nanoseconds and sizes in bytes.
+//
+// By default the scan stops at the end of the first block of the section.
+// With --merge=first or --merge=last every block of a repeated section is
+// merged, and the first or last occurrence of the key wins. --tail finds the
+// same answer as --merge=last by reading the file backwards from the end,
+// which is much cheaper when the override sits near the end of a big file.
+//
+//     inireader set <path-to-ini-file> <section-name> <value-name> <new-value>
+//
+// replaces the value the lookup would have printed. A value that fits in
+// the old one's place is patched in place; anything longer rewrites the file
+// to a temporary and renames it over the original.
+//
+//     inireader --bulk=<edit-script> <path-to-ini-file>
+//
+// applies a script of set, delete and add-section edits (see editor.h) in a
+// single pass, writes the file once and reports what each edit matched. The
+// script is read from standard input if it is "-".
+//
+//     inireader delete <path-to-ini-file> <section-name> <value-name>
+//
+// removes the entry the lookup would have found.
+//
+// With --journal, set and delete do not touch the file at all: the edit is
+// appended to <path-to-ini-file>.journal (see journal.h), and lookups with
+// --journal check the journal before the file. Once the journal grows past
+// 1 MiB a compaction is started in the background;
+//
+//     inireader compact <path-to-ini-file>
+//
+// folds the journal into the file on demand.
+//
+//     inireader [--merge=first|last] [--threads=N] [--log=<file>] [--metrics=<file>]
+//               --serve=<socket> <path-to-ini-file>
+//
+// answers lookups on a Unix socket (see server.h) with one event loop per
+// core, or N of them, until it is interrupted. The file is reloaded whenever
+// it is rewritten or replaced, and on SIGHUP. Its metrics (see metrics.h)
+// can be read with "METRICS" on the socket, and --metrics=<file> rewrites
+// them to a file every 10 seconds for node_exporter's textfile collector.
+//
+//     inireader [--merge=first|last] [--threads=N] [--io=uring|read]
+//               find <section-name> <value-name> <path>...
+//
+// looks the key up in every file given, or in every file named on standard
+// input if the only path is "-", and prints the path and the value of each
+// file that has it. The files are read in batches through io_uring where
+// it is available, or one by one with --io=read, and parsed on N worker
+// threads that steal work from each other, with files of 2 MiB and more
+// split into chunks; --stats reports the files read per second and the
+// workers' steals and idle time.
+//
+// --log=<file> appends every lookup, with whether it was found and how long
+// it took, to a binary query log (see querylog.h), for the CLI and the
+// server alike. bench/query_replay replays such a log.
+//
+// --trace=<file> writes a timeline of the run's phases (see trace.h) in the
+// Chrome trace-event format, for chrome://tracing or Perfetto.
+//
+// --io=auto|stream|read|mmap|direct|uring|pipeline picks the I/O backend of
+// the default scan (see linereader.h). auto, the default, chooses one from
+// the file's type, its storage and its size.
+//
+// --stats prints statistics of the run to standard error: those of find,
+// and in a build with ALLOC_STATS=1 the heap allocations of each phase
+// (see allocstats.h).
 
-#include <algorithm>
-#include <cctype>
+#include "allocstats.h"
+#include "batchread.h"
+#include "chunkscan.h"
+#include "convert.h"
+#include "document.h"
+#include "editor.h"
+#include "ini.h"
+#include "journal.h"
+#include "linereader.h"
+#include "metrics.h"
+#include "probes.h"
+#include "querylog.h"
+#include "scheduler.h"
+#include "server.h"
+#include "snapshot.h"
+#include "tailscan.h"
+#include "trace.h"
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <poll.h>
 #include <string>
 #include <string_view>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 using namespace std;
 
-// Represents a name-value pair parsed from an INI file line.
-class Entry {
-public:
-    Entry() = default;
-    Entry(string name, string value)
-        : n(std::move(name))
-        , v(std::move(value)) { }
+// Command line options that precede the three positional arguments
+struct Options {
+    string_view type;                      // --type=<kind>: print the value converted to kind
+    Merge       merge   = Merge::None;     // --merge=first|last: merge repeated sections
+    bool        indexed = false;           // look up through a Document instead of streaming
+    bool        tail    = false;           // --tail: last occurrence, scanning back from EOF
+    bool        journal = false;           // --journal: edits go to, and lookups check, the journal
+    unsigned    threads = 0;               // --threads=N: event loops for serve, 0 for one per core
+    string_view log;                       // --log=<file>: append lookups to a query log
+    string_view metrics;                   // --metrics=<file>: export serve's metrics to a file
+    string_view trace;                     // --trace=<file>: write a Chrome trace of the run
+    bool        stats   = false;           // --stats: print allocation counts per phase
+    IoBackend   io      = IoBackend::Auto; // --io=<backend>: how the default scan reads the file
+    string_view bulk;                      // --bulk=<script>: apply an edit script to the one path
+    string_view serve;                     // --serve=<socket>: serve lookups of the one path
+};
+
+// Parse leading --options; returns the index of the first positional
+// argument, or -1 on an unknown or malformed option
+int parse_options(int argc, char* argv[], Options& opts) {
+    int i = 1;
+    for (; i < argc; ++i) {
+        string_view arg(argv[i]);
+        if (!arg.starts_with("--")) {
+            break;
+        }
+        if (arg.starts_with("--type=")) {
+            opts.type = arg.substr(7);
+            if (opts.type != "int" && opts.type != "bool" && opts.type != "double" && opts.type != "duration"
+                && opts.type != "size") {
+                cerr << "Unknown type \"" << opts.type << "\"\n";
+                return -1;
+            }
+        } else if (arg == "--merge=first") {
+            opts.merge   = Merge::FirstWins;
+            opts.indexed = true;
+        } else if (arg == "--merge=last") {
+            opts.merge   = Merge::LastWins;
+            opts.indexed = true;
+        } else if (arg == "--tail") {
+            opts.tail = true;
+        } else if (arg == "--journal") {
+            opts.journal = true;
+        } else if (arg.starts_with("--log=") && arg.size() > 6) {
+            opts.log = arg.substr(6);
+        } else if (arg.starts_with("--metrics=") && arg.size() > 10) {
+            opts.metrics = arg.substr(10);
+        } else if (arg.starts_with("--bulk=") && arg.size() > 7) {
+            opts.bulk = arg.substr(7);
+        } else if (arg.starts_with("--serve=") && arg.size() > 8) {
+            opts.serve = arg.substr(8);
+        } else if (arg.starts_with("--trace=") && arg.size() > 8) {
+            opts.trace = arg.substr(8);
+        } else if (arg.starts_with("--io=")) {
+            auto backend = parse_backend(arg.substr(5));
+            if (!backend) {
+                cerr << "Unknown I/O backend \"" << arg.substr(5) << "\"\n";
+                return -1;
+            }
+            opts.io = *backend;
+        } else if (arg == "--stats") {
+            opts.stats = true;
+        } else if (arg.starts_with("--threads=")) {
+            string_view n   = arg.substr(10);
+            auto        res = from_chars(n.data(), n.data() + n.size(), opts.threads);
+            if (res.ec != errc() || res.ptr != n.data() + n.size() || opts.threads == 0) {
+                cerr << "Invalid thread count \"" << n << "\"\n";
+                return -1;
+            }
+        } else {
+            cerr << "Unknown option \"" << arg << "\"\n";
+            return -1;
+        }
+    }
+    return i;
+}
+
+// Print value converted to the requested type; returns false if the value
+// does not convert
+bool print_typed(string_view value, string_view type) {
+    char buf[32];
+    if (type == "int") {
+        if (auto v = to_int(value)) {
+            cout << *v;
+            return true;
+        }
+    } else if (type == "bool") {
+        if (auto v = to_bool(value)) {
+            cout << (*v ? "true" : "false");
+            return true;
+        }
+    } else if (type == "double") {
+        if (auto v = to_double(value)) {
+            auto res = to_chars(buf, buf + sizeof(buf), *v);
+            cout << string_view(buf, static_cast<size_t>(res.ptr - buf));
+            return true;
+        }
+    } else if (type == "duration") {
+        if (auto v = to_duration(value)) {
+            cout << v->count();
+            return true;
+        }
+    } else if (type == "size") {
+        if (auto v = to_size(value)) {
+            cout << *v;
+            return true;
+        }
+    }
+    cerr << "Error: value \"" << value << "\" is not a valid " << type << "\n";
+    return false;
+}
 
-    [[nodiscard]] bool valid() const noexcept {
-        return !n.empty() && !v.empty();
+// Print a found value, converting it first if --type was given; returns
+// the exit status
+int print_value(string_view value, const Options& opts) {
+    TraceScope trace("output");
+    if (!opts.type.empty()) {
+        return print_typed(value, opts.type) ? 0 : 4;
     }
+    cout << value;
+    return 0;
+}
+
+int not_found(string_view section, string_view name) {
+    cerr << "Entry \"" << name << "\" not found in section [" << section << "]\n";
+    return 2;
+}
+
+int open_failed(const filesystem::path& path) {
+    cerr << "Error: could not open file \"" << path.string() << "\"\n";
+    return 3;
+}
+
+int read_failed(const filesystem::path& path) {
+    cerr << "Error: could not read file \"" << path.string() << "\": " << strerror(errno) << "\n";
+    return 3;
+}
 
-    void clear() noexcept {
-        n.clear();
-        v.clear();
+int update_failed(const filesystem::path& path) {
+    cerr << "Error: could not update file \"" << path.string() << "\": " << strerror(errno) << "\n";
+    return 3;
+}
+
+// Streaming fast path: read line by line and stop at the end of the first
+// block of the target section. Only correct when a section is not repeated
+// later in the file.
+int lookup_streaming(const filesystem::path& path, string_view section, string_view name, const Options& opts) {
+    LineReader reader;
+    bool       opened = reader.open(path, opts.io);
+    INI_PROBE2(file__open, path.c_str(), opened);
+    if (!opened) {
+        return open_failed(path);
     }
 
-    [[nodiscard]] const string& name() const noexcept { return n; }
-    [[nodiscard]] const string& value() const noexcept { return v; }
+    optional<string_view> value; // into the reader's buffer, valid while it lives
+    {
+        string_view line;
+        size_t      line_number = 0;
+        bool        in_section  = false;
+        Entry       entry;
+        TraceScope  trace("scan");
+        AllocScope  phase(AllocPhase::Reading); // trim and parse charge their own phases
 
-    friend bool                 parse_section_entry(const string& line, Entry& e);
+        while (reader.next(line)) {
+            ++line_number;
+            string_view trimmed = trim(line);
+            if (is_ignorable(trimmed)) {
+                continue;
+            }
 
-private:
-    string n;
-    string v;
-};
+            if (is_header(trimmed)) {
+                if (in_section) {
+                    break; // leaving target section
+                }
+                in_section = is_section(trimmed, section);
+                if (in_section) {
+                    INI_PROBE3(section__match, trimmed.data(), trimmed.size(), line_number);
+                }
+                continue;
+            }
 
-// Case-insensitive string comparison
-[[nodiscard]] bool iequals(string_view a, string_view b) noexcept {
-    return a.size() == b.size() && equal(a.begin(), a.end(), b.begin(), [](unsigned char x, unsigned char y) {
-               return tolower(x) == tolower(y);
-           });
+            if (in_section && parse_section_entry(trimmed, entry)) {
+                INI_PROBE3(entry__parse, entry.name().data(), entry.name().size(), line_number);
+                if (entry.valid() && iequals(entry.name(), name)) {
+                    value = entry.value();
+                    break;
+                }
+            }
+        }
+    }
+
+    if (value) {
+        INI_PROBE2(key__match, value->data(), value->size());
+        return print_value(*value, opts);
+    }
+    if (reader.failed()) {
+        return read_failed(path);
+    }
+    return not_found(section, name);
+}
+
+// Indexed path: parse the whole file into a Document, merging repeated
+// sections under the requested precedence
+int lookup_indexed(const filesystem::path& path, string_view section, string_view name, const Options& opts) {
+    Document doc;
+    bool     loaded = doc.load(path, opts.merge);
+    INI_PROBE2(file__open, path.c_str(), loaded);
+    if (!loaded) {
+        return open_failed(path);
+    }
+    optional<string_view> value;
+    {
+        TraceScope trace("lookup");
+        AllocScope phase(AllocPhase::Lookup);
+        value = doc.get(section, name);
+    }
+    if (value) {
+        INI_PROBE2(key__match, value->data(), value->size());
+        return print_value(*value, opts);
+    }
+    return not_found(section, name);
 }
 
-// Trim leading/trailing whitespace
-[[nodiscard]] string trim(string_view sv) {
-    auto is_not_space = [](unsigned char c) { return !isspace(c); };
-    auto start        = find_if(sv.begin(), sv.end(), is_not_space);
-    auto end          = find_if(sv.rbegin(), sv.rend(), is_not_space).base();
-    return (start < end) ? string(start, end) : string {};
+// Tail path: the last occurrence of the key wins, found by reading blocks
+// backwards from the end of the file. Pipes and other unseekable inputs
+// fall back to a last-wins Document.
+int lookup_tail(const filesystem::path& path, string_view section, string_view name, Options opts) {
+    TailScanner scanner;
+    if (!scanner.open(path)) {
+        opts.merge = Merge::LastWins;
+        return lookup_indexed(path, section, name, opts);
+    }
+    INI_PROBE2(file__open, path.c_str(), true);
+    optional<string> value;
+    {
+        AllocScope phase(AllocPhase::Lookup);
+        value = scanner.find_last(section, name);
+    }
+    if (scanner.failed()) {
+        return read_failed(path);
+    }
+    if (value) {
+        INI_PROBE2(key__match, value->data(), value->size());
+        return print_value(*value, opts);
+    }
+    return not_found(section, name);
 }
 
-// Remove surrounding quotes if present
-[[nodiscard]] string unquote(string_view sv) {
-    if (sv.size() >= 2 && sv.front() == '"' && sv.back() == '"') {
-        sv.remove_prefix(1);
-        sv.remove_suffix(1);
+// set mode: replace one value in place
+int set_command(const filesystem::path& path, string_view section, string_view name, string_view value) {
+    switch (set_value(path, section, name, value)) {
+    case SetResult::Patched:
+    case SetResult::Rewritten:
+        return 0;
+    case SetResult::NotFound:
+        return not_found(section, name);
+    case SetResult::Failed:
+        break;
     }
-    return string(sv);
+    return update_failed(path);
 }
 
-// Parse a line as a key=value entry; returns true if successful
-bool parse_section_entry(const string& line, Entry& e) {
-    e.clear();
-    string trimmed = trim(line);
-    if (trimmed.empty()) {
-        return false;
+// bulk mode: apply an edit script in one pass and report every edit
+int bulk_command(const filesystem::path& path, const string& script) {
+    vector<Edit> edits;
+    string       error;
+    ifstream     script_file;
+    if (script != "-") {
+        script_file.open(script);
+        if (!script_file) {
+            return open_failed(script);
+        }
+    }
+    if (!parse_edit_script(script == "-" ? cin : script_file, edits, error)) {
+        cerr << "Error: " << script << ": " << error << "\n";
+        return 1;
     }
 
-    if (auto pos = trimmed.find('='); pos != string::npos) {
-        string name  = trim(trimmed.substr(0, pos));
-        string value = unquote(trim(trimmed.substr(pos + 1)));
+    if (!apply_edits(path, edits)) {
+        return update_failed(path);
+    }
 
-        if (!name.empty()) {
-            e = Entry { std::move(name), std::move(value) };
-            return true;
+    bool all_matched = true;
+    for (const Edit& e : edits) {
+        cout << "line " << e.line << ": ";
+        switch (e.op) {
+        case Edit::Set:
+            cout << "set [" << e.section << "] " << e.key;
+            break;
+        case Edit::Delete:
+            cout << "delete [" << e.section << "] " << e.key;
+            break;
+        case Edit::AddSection:
+            cout << "add-section [" << e.section << "]";
+            break;
         }
+        cout << ": " << status_name(e.status) << "\n";
+        all_matched = all_matched && e.status != Edit::NotFound;
     }
-    return false;
+    return all_matched ? 0 : 2;
+}
+
+// Journal overlay: a journaled set or delete of the key decides the lookup
+// before the file is read; returns -1 if the journal has nothing to say
+int lookup_journal(const filesystem::path& path, string_view section, string_view name, const Options& opts) {
+    Journal journal;
+    if (!journal.load(path)) {
+        return open_failed(journal_path(path));
+    }
+    string_view value;
+    switch (journal.find(section, name, value)) {
+    case Journal::State::Set:
+        return print_value(value, opts);
+    case Journal::State::Deleted:
+        return not_found(section, name);
+    case Journal::State::Absent:
+        break;
+    }
+    return -1;
 }
 
-// Check if a line represents the desired section header [Section]
-[[nodiscard]] bool is_section(const string& line, string_view section_name) {
-    if (line.size() < 3 || line.front() != '[' || line.back() != ']') {
-        return false;
+// Append an edit to the journal, compacting in a child process once the
+// journal has grown large enough. The edit is recorded without reading the
+// file, so a delete of a key that does not exist succeeds here.
+int journal_command(const filesystem::path& path, const Edit& edit) {
+    if (!journal_append(path, edit)) {
+        return update_failed(journal_path(path));
     }
 
-    string inner = trim(line.substr(1, line.size() - 2));
-    return iequals(inner, section_name);
+    struct stat st;
+    if (::stat(journal_path(path).c_str(), &st) == 0
+        && static_cast<uint64_t>(st.st_size) >= journal_compact_threshold && ::fork() == 0) {
+        // Let go of the caller's terminal and pipes, so that one capturing
+        // the output does not wait for the compaction
+        ::setsid();
+        int null = ::open("/dev/null", O_RDWR | O_CLOEXEC);
+        for (int fd = 0; null >= 0 && fd <= 2; ++fd) {
+            ::dup2(null, fd);
+        }
+        _exit(compact_journal(path) ? 0 : 3);
+    }
+    return 0;
 }
 
-// Main program
-int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        cerr << "Usage: " << argv[0] << " <path> <section> <name>\n";
-        return 1;
+// delete mode: remove the entry the lookup would have found
+int delete_command(const filesystem::path& path, string_view section, string_view name) {
+    vector<Edit> edits(1);
+    edits[0].op      = Edit::Delete;
+    edits[0].section = section;
+    edits[0].key     = name;
+    if (!apply_edits(path, edits)) {
+        return update_failed(path);
     }
+    return edits[0].status == Edit::NotFound ? not_found(section, name) : 0;
+}
+
+// compact mode: fold the journal into the file
+int compact_command(const filesystem::path& path) {
+    return compact_journal(path) ? 0 : update_failed(path);
+}
+
+constexpr size_t find_chunk = 1024 * 1024; // find splits files of two or more into chunks of this size
+
+// A file that find scans in chunks, shared by their tasks
+struct SplitFile {
+    string              text;
+    vector<string_view> chunks;
+    vector<ChunkScan>   scans;
+    atomic<size_t>      left {0}; // chunks not yet scanned
+};
 
-    const filesystem::path path(argv[1]);
-    const string           section(argv[2]);
-    const string           name(argv[3]);
+// find mode: look up one key in many files, reading them in batches (see
+// batchread.h) and parsing them on --threads workers of a work-stealing
+// scheduler (see scheduler.h). A small file is parsed whole in one task; a
+// large one is split into chunk tasks (see chunkscan.h) that idle workers
+// steal, and the last of them to finish settles its value. Prints
+// "path<TAB>value" for every file that has the key, in the order given.
+int find_command(const string& section, const string& name, vector<filesystem::path> paths, const Options& opts) {
+    if (paths.size() == 1 && paths[0] == "-") {
+        paths.clear();
+        string line;
+        while (getline(cin, line)) {
+            if (!line.empty()) {
+                paths.emplace_back(line);
+            }
+        }
+    }
+
+    vector<optional<string>> values(paths.size());
+    vector<int>              errors(paths.size());
+    const unsigned           workers   = opts.threads ? opts.threads : max(1u, thread::hardware_concurrency());
+    const bool               use_uring = opts.io == IoBackend::Auto || opts.io == IoBackend::Uring;
+
+    Scheduler      pool(workers);
+    atomic<size_t> chunks {0}; // of the files scanned in chunks
+
+    const auto start = chrono::steady_clock::now();
+    BatchStats stats = read_files(paths, pool, use_uring, [&](size_t i, string& text, int error) {
+        errors[i] = error;
+        if (error) {
+            return;
+        }
+        if (text.size() < 2 * find_chunk) {
+            Document doc;
+            doc.parse(std::move(text), opts.merge);
+            if (auto value = doc.get(section, name)) {
+                values[i] = string(*value);
+            }
+            return;
+        }
+        auto file    = make_shared<SplitFile>();
+        file->text   = std::move(text);
+        file->chunks = split_chunks(file->text, find_chunk);
+        file->scans.resize(file->chunks.size());
+        file->left = file->chunks.size();
+        chunks.fetch_add(file->chunks.size(), memory_order_relaxed);
+        for (size_t c = 0; c < file->chunks.size(); ++c) {
+            pool.spawn([&, i, c, file] {
+                file->scans[c] = scan_chunk(file->chunks[c], section, name, opts.merge);
+                if (file->left.fetch_sub(1) == 1) {
+                    if (auto value = join_chunks(file->scans, opts.merge)) {
+                        values[i] = string(*value);
+                    }
+                }
+            });
+        }
+    });
+    const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
 
-    ifstream               file(path);
-    if (!file) {
-        cerr << "Error: could not open file \"" << path.string() << "\"\n";
+    bool found = false;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        if (errors[i]) {
+            cerr << "Error: could not read file \"" << paths[i].string() << "\": " << strerror(errors[i]) << "\n";
+        } else if (values[i]) {
+            cout << paths[i].string() << '\t' << *values[i] << '\n';
+            found = true;
+        }
+    }
+    if (opts.stats) {
+        char buf[160];
+        snprintf(buf, sizeof(buf), "files=%zu failed=%zu bytes=%llu seconds=%.3f files/s=%.0f reader=%s\n",
+                 stats.files, stats.failed, static_cast<unsigned long long>(stats.bytes), seconds,
+                 seconds > 0 ? static_cast<double>(stats.files) / seconds : 0.0, stats.uring ? "uring" : "sync");
+        cerr << buf;
+        const SchedulerStats sched = pool.stats();
+        snprintf(buf, sizeof(buf), "workers=%u tasks=%llu chunks=%zu steals=%llu idle-seconds=%.3f\n", sched.workers,
+                 static_cast<unsigned long long>(sched.tasks), chunks.load(),
+                 static_cast<unsigned long long>(sched.steals), sched.idle_seconds);
+        cerr << buf;
+    }
+    return stats.failed ? 3 : found ? 0 : 2;
+}
+
+constexpr auto metrics_period = chrono::seconds(10); // between --metrics exports
+
+// serve mode: answer lookups on a Unix socket until SIGINT or SIGTERM;
+// SIGHUP or a change to the file reloads it
+int serve_command(const filesystem::path& path, const filesystem::path& socket, const Options& opts) {
+    // Blocked before the loops start so they inherit the mask and the
+    // signals are left for the signalfd below
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    SnapshotHandle docs;
+    if (!docs.reload(path, opts.merge)) {
+        return open_failed(path);
+    }
+
+    Server server(docs);
+    if (!opts.log.empty() && !server.log_queries(opts.log, filesystem::absolute(path))) {
+        cerr << "Error: could not open query log \"" << opts.log << "\": " << strerror(errno) << "\n";
+        return 3;
+    }
+    if (!server.listen(socket) || !server.start(opts.threads)) {
+        cerr << "Error: could not listen on \"" << socket.string() << "\": " << strerror(errno) << "\n";
         return 3;
     }
 
-    string line;
-    bool   in_section = false;
-    Entry  entry;
+    // The directory is watched rather than the file, so that a file
+    // replaced by a rename is noticed as well as one written in place. A
+    // new file is only read once closed after writing or renamed into place.
+    int sig_fd    = ::signalfd(-1, &signals, SFD_CLOEXEC);
+    int notify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (notify_fd >= 0) {
+        filesystem::path dir = path.parent_path().empty() ? "." : path.parent_path();
+        ::inotify_add_watch(notify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+    const string name = path.filename().string();
 
-    while (getline(file, line)) {
-        string trimmed = trim(line);
-        if (trimmed.empty() || trimmed.starts_with(';') || trimmed.starts_with('#')) {
-            continue;
+    auto reload = [&] {
+        if (!docs.reload(path, opts.merge)) {
+            cerr << "Error: could not reload \"" << path.string() << "\"; still serving the previous version\n";
+        }
+    };
+
+    // With --metrics the exposition file is rewritten every few seconds
+    auto next_export    = chrono::steady_clock::now();
+    auto export_metrics = [&] {
+        next_export = chrono::steady_clock::now() + metrics_period;
+        if (!write_textfile(filesystem::path(opts.metrics), server.metrics())) {
+            cerr << "Error: could not write metrics to \"" << opts.metrics << "\": " << strerror(errno) << "\n";
         }
+    };
 
-        if (trimmed.starts_with('[') && trimmed.ends_with(']')) {
-            if (in_section) {
-                break; // leaving target section
+    for (bool running = sig_fd >= 0; running;) {
+        int timeout = -1;
+        if (!opts.metrics.empty()) {
+            if (chrono::steady_clock::now() >= next_export) {
+                export_metrics();
             }
-            in_section = is_section(trimmed, section);
-            continue;
+            auto left = chrono::duration_cast<chrono::milliseconds>(next_export - chrono::steady_clock::now());
+            timeout   = static_cast<int>(max<int64_t>(0, left.count()) + 1);
         }
 
-        if (in_section && parse_section_entry(trimmed, entry)) {
-            if (entry.valid() && iequals(entry.name(), name)) {
-                cout << entry.value();
-                return 0;
+        pollfd fds[2] = { { sig_fd, POLLIN, 0 }, { notify_fd, POLLIN, 0 } };
+        if (::poll(fds, notify_fd >= 0 ? 2 : 1, timeout) < 0) {
+            running = errno == EINTR;
+            continue;
+        }
+        if (fds[0].revents & POLLIN) {
+            signalfd_siginfo info;
+            if (::read(sig_fd, &info, sizeof(info)) == sizeof(info) && info.ssi_signo != SIGHUP) {
+                running = false;
+                continue;
+            }
+            reload();
+        }
+        if (notify_fd >= 0 && (fds[1].revents & POLLIN)) {
+            alignas(inotify_event) char buf[4096];
+            bool                        changed = false;
+            ssize_t                     n;
+            while ((n = ::read(notify_fd, buf, sizeof(buf))) > 0) {
+                for (char* p = buf; p < buf + n;) {
+                    auto* event = reinterpret_cast<inotify_event*>(p);
+                    changed |= event->len > 0 && name == event->name;
+                    p += sizeof(inotify_event) + event->len;
+                }
+            }
+            if (changed) {
+                reload();
             }
         }
     }
 
-    cerr << "Entry \"" << name << "\" not found in section [" << section << "]\n";
-    return 2;
+    server.stop();
+    if (!opts.metrics.empty()) {
+        export_metrics();
+    }
+    if (notify_fd >= 0) {
+        ::close(notify_fd);
+    }
+    if (sig_fd >= 0) {
+        ::close(sig_fd);
+    }
+    return 0;
+}
+
+// Look the key up with the engine the options ask for; returns the exit
+// status
+int lookup(const filesystem::path& path, string_view section, string_view name, const Options& opts) {
+    if (opts.journal) {
+        if (int status = lookup_journal(path, section, name, opts); status >= 0) {
+            return status;
+        }
+    }
+    if (opts.tail) {
+        return lookup_tail(path, section, name, opts);
+    }
+    if (opts.indexed) {
+        return lookup_indexed(path, section, name, opts);
+    }
+    return lookup_streaming(path, section, name, opts);
+}
+
+// Run the command the arguments ask for; returns the exit status
+int run(int argc, char* argv[], int first, const Options& opts) {
+    if (first >= 0 && argc - first == 5 && string_view(argv[first]) == "set") {
+        if (opts.journal) {
+            Edit edit;
+            edit.op      = Edit::Set;
+            edit.section = argv[first + 2];
+            edit.key     = argv[first + 3];
+            edit.value   = argv[first + 4];
+            return journal_command(argv[first + 1], edit);
+        }
+        return set_command(argv[first + 1], argv[first + 2], argv[first + 3], argv[first + 4]);
+    }
+    if (first >= 0 && argc - first == 4 && string_view(argv[first]) == "delete") {
+        if (opts.journal) {
+            Edit edit;
+            edit.op      = Edit::Delete;
+            edit.section = argv[first + 2];
+            edit.key     = argv[first + 3];
+            return journal_command(argv[first + 1], edit);
+        }
+        return delete_command(argv[first + 1], argv[first + 2], argv[first + 3]);
+    }
+    if (first >= 0 && argc - first == 2 && string_view(argv[first]) == "compact") {
+        return compact_command(argv[first + 1]);
+    }
+    // Modes taking a single path are options, so that no file name can be
+    // mistaken for them
+    if (first >= 0 && argc - first == 1 && !opts.serve.empty() && opts.bulk.empty()) {
+        return serve_command(argv[first], string(opts.serve), opts);
+    }
+    if (first >= 0 && argc - first == 1 && !opts.bulk.empty() && opts.serve.empty()) {
+        return bulk_command(argv[first], string(opts.bulk));
+    }
+    if (first >= 0 && argc - first >= 4 && string_view(argv[first]) == "find") {
+        return find_command(argv[first + 1], argv[first + 2], vector<filesystem::path>(argv + first + 3, argv + argc),
+                            opts);
+    }
+    if (first < 0 || argc - first != 3 || !opts.bulk.empty() || !opts.serve.empty()) {
+        cerr << "Usage: " << argv[0]
+             << " [--type=int|bool|double|duration|size] [--merge=first|last] [--tail] [--journal] [--log=<file>]"
+             << " [--io=<backend>] [--trace=<file>] [--stats] <path> <section> <name>\n"
+             << "       " << argv[0] << " [--journal] set <path> <section> <name> <value>\n"
+             << "       " << argv[0] << " [--journal] delete <path> <section> <name>\n"
+             << "       " << argv[0] << " --bulk=<edit-script> <path>\n"
+             << "       " << argv[0] << " compact <path>\n"
+             << "       " << argv[0]
+             << " [--merge=first|last] [--threads=N] [--io=uring|read] [--stats] find <section> <name> <path>...\n"
+             << "       " << argv[0]
+             << " [--merge=first|last] [--threads=N] [--log=<file>] [--metrics=<file>] --serve=<socket> <path>\n";
+        return 1;
+    }
+
+    const filesystem::path path(argv[first]);
+    const string           section(argv[first + 1]);
+    const string           name(argv[first + 2]);
+
+    INI_PROBE3(lookup__start, path.c_str(), section.c_str(), name.c_str());
+    const auto start  = chrono::steady_clock::now();
+    const int  status = lookup(path, section, name, opts);
+    INI_PROBE1(lookup__done, status);
+    if (!opts.log.empty()) {
+        QueryLog log;
+        if (!log.open(opts.log)) {
+            cerr << "Error: could not open query log \"" << opts.log << "\": " << strerror(errno) << "\n";
+            return status;
+        }
+        // Status 4 is a value that was found but did not convert
+        log.record(filesystem::absolute(path).native(), section, name, status == 0 || status == 4,
+                   chrono::steady_clock::now() - start);
+    }
+    return status;
+}
+
+// Heap allocations of each phase, for --stats in a profiling build
+void print_alloc_stats() {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%-10s %12s %12s %14s %14s\n", "phase", "allocations", "frees", "bytes", "peak_live");
+    cerr << buf;
+    for (size_t i = 0; i < alloc_phases; ++i) {
+        auto        phase = static_cast<AllocPhase>(i);
+        AllocCounts c     = alloc_counts(phase);
+        snprintf(buf, sizeof(buf), "%-10s %12llu %12llu %14llu %14llu\n", phase_name(phase),
+                 static_cast<unsigned long long>(c.allocations), static_cast<unsigned long long>(c.frees),
+                 static_cast<unsigned long long>(c.bytes), static_cast<unsigned long long>(c.peak_live));
+        cerr << buf;
+    }
+}
+
+// Main program
+int main(int argc, char* argv[]) {
+    Options opts;
+    int     first = parse_options(argc, argv, opts);
+    if (!opts.trace.empty()) {
+        trace_start();
+    }
+
+    int status = run(argc, argv, first, opts);
+
+    if (opts.stats && alloc_stats_built) {
+        print_alloc_stats();
+    }
+    if (!opts.trace.empty() && !trace_write(filesystem::path(opts.trace))) {
+        cerr << "Error: could not write trace to \"" << opts.trace << "\": " << strerror(errno) << "\n";
+    }
+    return status;
 }
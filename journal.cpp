@@ -0,0 +1,204 @@
+// Append-only edit journal kept next to an INI file.
+
+#include "journal.h"
+
+#include "cst.h"
+#include "ini.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/file.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+filesystem::path compacting_path(const filesystem::path& path) {
+    return journal_path(path).string() + ".compacting";
+}
+
+filesystem::path lock_path(const filesystem::path& path) {
+    return journal_path(path).string() + ".lock";
+}
+
+filesystem::path compact_lock_path(const filesystem::path& path) {
+    return journal_path(path).string() + ".compact";
+}
+
+// Append the complete records of one journal file to edits
+bool read_journal(const filesystem::path& file, vector<Edit>& edits) {
+    ifstream in(file, ios::binary);
+    if (!in) {
+        return errno == ENOENT;
+    }
+
+    string line;
+    string error;
+    while (getline(in, line)) {
+        if (in.eof()) {
+            break; // no line break: an append that did not finish
+        }
+        Edit edit;
+        if (!is_ignorable(trim(line)) && parse_edit(line, edit, error)) {
+            edits.push_back(std::move(edit));
+        }
+    }
+    return !in.bad();
+}
+
+// Apply one journal file to the base file, then remove it. The edits are
+// replayed in order on a SyntaxTree, so comments and formatting survive and
+// the file is written once. Unlike apply_edits(), a set creates its section
+// when it is missing.
+bool fold(const filesystem::path& path, const filesystem::path& file) {
+    vector<Edit> edits;
+    if (!read_journal(file, edits)) {
+        return false;
+    }
+
+    if (!edits.empty()) {
+        SyntaxTree tree;
+        if (!tree.load(path)) {
+            return false;
+        }
+        for (const Edit& e : edits) {
+            if (e.op == Edit::Set) {
+                // A set may target a section that only exists in the journal
+                tree.add_section(e.section);
+                tree.set(e.section, e.key, e.value);
+            } else if (e.op == Edit::Delete) {
+                tree.remove(e.section, e.key);
+            }
+        }
+        if (tree.modified() && !replace_contents(path, [&](int fd) { return tree.write(fd); })) {
+            return false;
+        }
+    }
+    return ::unlink(file.c_str()) == 0 || errno == ENOENT;
+}
+
+} // namespace
+
+filesystem::path journal_path(const filesystem::path& path) {
+    return path.string() + ".journal";
+}
+
+bool journal_append(const filesystem::path& path, const Edit& edit) {
+    if (edit.op == Edit::AddSection || !fits_on_line(edit.section, edit.key, edit.value)
+        || edit.key.find(']') != string::npos) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // A shared lock keeps compaction from moving the journal aside between
+    // the open and the write, which would put the record in a file that has
+    // already been folded
+    int lock = ::open(lock_path(path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock < 0) {
+        return false;
+    }
+    int fd = -1;
+    if (::flock(lock, LOCK_SH) == 0) {
+        fd = ::open(journal_path(path).c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        int saved = errno;
+        ::close(lock);
+        errno = saved;
+        return false;
+    }
+
+    // One write per record keeps concurrent appenders from interleaving
+    string  record = format_edit(edit);
+    ssize_t n      = ::write(fd, record.data(), record.size());
+    int     saved  = errno;
+    ::close(fd);
+    ::close(lock);
+    if (n != static_cast<ssize_t>(record.size())) {
+        errno = n < 0 ? saved : EIO;
+        return false;
+    }
+    return true;
+}
+
+// The shared lock keeps a compaction from moving the journal aside between
+// the two reads, which would hide its records from both. Without a lock
+// file no journal has been written yet.
+bool Journal::load(const filesystem::path& path) {
+    records.clear();
+    int lock = ::open(lock_path(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (lock < 0 && errno != ENOENT) {
+        return false;
+    }
+    if (lock >= 0 && ::flock(lock, LOCK_SH) != 0) {
+        int saved = errno;
+        ::close(lock);
+        errno = saved;
+        return false;
+    }
+    bool ok   = read_journal(compacting_path(path), records) && read_journal(journal_path(path), records);
+    int saved = errno;
+    if (lock >= 0) {
+        ::close(lock);
+    }
+    errno = saved;
+    return ok;
+}
+
+Journal::State Journal::find(string_view section, string_view key, string_view& value) const noexcept {
+    for (auto it = records.rbegin(); it != records.rend(); ++it) {
+        if (iequals(it->section, section) && iequals(it->key, key)) {
+            if (it->op == Edit::Delete) {
+                return State::Deleted;
+            }
+            value = it->value;
+            return State::Set;
+        }
+    }
+    return State::Absent;
+}
+
+// Compactions exclude each other with a lock of their own, which is only
+// tried: one that finds another under way leaves the journal to it rather
+// than make its caller wait. The journal's lock is taken exclusively only
+// for the rename, so no append is still on its way into the journal being
+// folded, and appends go on to a fresh journal during the fold.
+bool compact_journal(const filesystem::path& path) {
+    int compact = ::open(compact_lock_path(path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (compact < 0) {
+        return false;
+    }
+    if (::flock(compact, LOCK_EX | LOCK_NB) != 0) {
+        ::close(compact);
+        return errno == EWOULDBLOCK;
+    }
+
+    // Finish a compaction that was interrupted, then move the live journal
+    // aside and compact it
+    const filesystem::path compacting = compacting_path(path);
+    bool                   ok         = fold(path, compacting);
+    if (ok) {
+        int  lock  = ::open(lock_path(path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        bool moved = false;
+        ok         = lock >= 0 && ::flock(lock, LOCK_EX) == 0;
+        if (ok) {
+            moved = ::rename(journal_path(path).c_str(), compacting.c_str()) == 0;
+            ok    = moved || errno == ENOENT;
+        }
+        int saved = errno;
+        if (lock >= 0) {
+            ::close(lock);
+        }
+        errno = saved;
+        if (moved) {
+            ok = fold(path, compacting);
+        }
+    }
+
+    int saved = errno;
+    ::close(compact);
+    errno = saved;
+    return ok;
+}
@@ -0,0 +1,69 @@
+// Append-only edit journal kept next to an INI file.
+//
+// Instead of rewriting a large file for every small change, set and delete
+// edits can be appended to <file>.journal, one edit script line each (see
+// editor.h), with a single O_APPEND write. Lookups overlay the journal on
+// the base file: the latest journal record for a key wins over whatever the
+// file says. Compaction replays the journal on a SyntaxTree (see cst.h),
+// writes the file once and starts a fresh journal.
+//
+// Compaction first renames the journal to <file>.journal.compacting, so
+// the next records land in a fresh journal, and readers overlay both.
+// Replaying a journal twice is harmless, so a compaction interrupted by a
+// crash is simply finished by the next one. Appends and loads take a shared
+// flock on <file>.journal.lock, which is left in place, and compaction an
+// exclusive one for the rename only, so a record is never written into a
+// journal after compaction has read it and a load never misses a journal
+// on its way aside. Appends made during a compaction go to the fresh
+// journal without waiting for it. Compactions exclude each other with a
+// flock on <file>.journal.compact.
+
+#pragma once
+
+#include "editor.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+[[nodiscard]] std::filesystem::path journal_path(const std::filesystem::path& path);
+
+// Append one set or delete edit to the journal of path. Values containing
+// line breaks cannot be journaled and fail with EINVAL.
+bool journal_append(const std::filesystem::path& path, const Edit& edit);
+
+class Journal {
+public:
+    // What the journal says about a key
+    enum class State {
+        Absent,  // no record; the base file decides
+        Set,     // the key has the value returned by find()
+        Deleted, // the key was deleted
+    };
+
+    // Read the journal of path, including one left by a compaction in
+    // progress. A missing journal is an empty one. A final record without
+    // its line break is a torn append and is ignored.
+    bool load(const std::filesystem::path& path);
+
+    [[nodiscard]] State find(std::string_view section, std::string_view key, std::string_view& value) const noexcept;
+
+    [[nodiscard]] const std::vector<Edit>& edits() const noexcept { return records; }
+    [[nodiscard]] bool                     empty() const noexcept { return records.empty(); }
+
+private:
+    std::vector<Edit> records; // oldest first
+};
+
+// Fold the journal of path into the file and remove it. Sections and keys
+// that journaled sets refer to are created if they do not exist. This is
+// not what the same edits do without the journal: apply_edits() (--bulk)
+// reports a set in a missing section as NotFound, and set_value() a set of
+// any missing key. Returns false on an I/O error, with errno set; if
+// another compaction holds its lock, returns true without doing anything.
+bool compact_journal(const std::filesystem::path& path);
+
+// Journal size beyond which journal_append() callers should compact
+constexpr uint64_t journal_compact_threshold = 1 << 20;
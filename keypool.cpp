@@ -0,0 +1,87 @@
+// Interning pool for key names.
+
+#include "keypool.h"
+
+#include "ini.h"
+
+#include <cctype>
+
+using namespace std;
+
+// Index of the slot holding key, or of the empty slot where it would go.
+// The table is a power of two in size and never more than half full.
+size_t KeyPool::probe(string_view key, uint64_t hash) const noexcept {
+    const size_t mask = table.size() - 1;
+    for (size_t i = static_cast<size_t>(hash) & mask;; i = (i + 1) & mask) {
+        uint32_t slot = table[i];
+        if (slot == 0) {
+            return i;
+        }
+        uint32_t id = slot - 1;
+        if (hashes[id] == static_cast<uint32_t>(hash) && iequals(name(id), key)) {
+            return i;
+        }
+    }
+}
+
+void KeyPool::grow() {
+    vector<uint32_t> old = std::move(table);
+    table.assign(old.empty() ? 64 : old.size() * 2, 0);
+
+    const size_t mask = table.size() - 1;
+    for (uint32_t slot : old) {
+        if (slot != 0) {
+            size_t i = hashes[slot - 1] & mask;
+            while (table[i] != 0) {
+                i = (i + 1) & mask;
+            }
+            table[i] = slot;
+        }
+    }
+}
+
+uint32_t KeyPool::intern(string_view key) {
+    if ((offsets.size() + 1) * 2 > table.size()) {
+        grow();
+    }
+
+    const uint64_t hash = ihash(key);
+    const size_t   i    = probe(key, hash);
+    if (table[i] != 0) {
+        return table[i] - 1;
+    }
+
+    const uint32_t id = static_cast<uint32_t>(offsets.size());
+    offsets.push_back(static_cast<uint32_t>(names.size()));
+    hashes.push_back(static_cast<uint32_t>(hash));
+    for (unsigned char c : key) {
+        names.push_back(static_cast<char>(tolower(c)));
+    }
+    table[i] = id + 1;
+    return id;
+}
+
+uint32_t KeyPool::find(string_view key) const noexcept {
+    return find(key, ihash(key));
+}
+
+uint32_t KeyPool::find(string_view key, uint64_t hash) const noexcept {
+    if (table.empty()) {
+        return npos;
+    }
+    const size_t i = probe(key, hash);
+    return table[i] == 0 ? npos : table[i] - 1;
+}
+
+string_view KeyPool::name(uint32_t id) const noexcept {
+    const uint32_t begin = offsets[id];
+    const uint32_t end   = id + 1 < offsets.size() ? offsets[id + 1] : static_cast<uint32_t>(names.size());
+    return string_view(names).substr(begin, end - begin);
+}
+
+void KeyPool::clear() noexcept {
+    names.clear();
+    offsets.clear();
+    hashes.clear();
+    table.clear();
+}
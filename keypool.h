@@ -0,0 +1,45 @@
+// Interning pool for key names.
+//
+// Inventory style files repeat the same handful of key names in every
+// section. A KeyPool stores each distinct name once, case-folded, and hands
+// out dense 32-bit ids, so a document can keep an id per entry instead of a
+// string and compare keys as integers. Looking a name up hashes it once and
+// never allocates.
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class KeyPool {
+public:
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    // Id of key, adding it to the pool if it is new
+    uint32_t intern(std::string_view key);
+
+    // Id of key, or npos if it was never interned
+    [[nodiscard]] uint32_t find(std::string_view key) const noexcept;
+
+    // As above, with ihash(key) already computed by the caller. A wrong
+    // hash can only make the lookup miss.
+    [[nodiscard]] uint32_t find(std::string_view key, uint64_t hash) const noexcept;
+
+    // Case-folded name of an interned id
+    [[nodiscard]] std::string_view name(uint32_t id) const noexcept;
+
+    [[nodiscard]] size_t size() const noexcept { return offsets.size(); }
+
+    void clear() noexcept;
+
+private:
+    [[nodiscard]] size_t probe(std::string_view key, uint64_t hash) const noexcept;
+    void                 grow();
+
+    std::string           names;   // all folded names, back to back
+    std::vector<uint32_t> offsets; // start of each id's name in names; ends at the next one
+    std::vector<uint32_t> hashes;  // low bits of each id's hash, to skip most compares
+    std::vector<uint32_t> table;   // open addressing; id + 1, or 0 for an empty slot
+};
@@ -0,0 +1,189 @@
+// Lazily materialized document for very large INI files.
+
+#include "lazydoc.h"
+
+#include "ini.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Read exactly n bytes at off; false on error or early EOF
+bool pread_full(int fd, char* buf, size_t n, uint64_t off) {
+    while (n > 0) {
+        ssize_t r = ::pread(fd, buf, n, static_cast<off_t>(off));
+        if (r <= 0) {
+            return false;
+        }
+        buf += r;
+        n -= static_cast<size_t>(r);
+        off += static_cast<uint64_t>(r);
+    }
+    return true;
+}
+
+} // namespace
+
+LazyDocument::~LazyDocument() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+// The pre-scan only looks at each line long enough to see whether it is a
+// header; entries are not parsed. Each header closes the previous block at
+// the start of its own line and opens a new one just past it.
+bool LazyDocument::open(const filesystem::path& path, Merge how) {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    slots.clear();
+    lru.clear();
+    resident = 0;
+    merge    = how;
+
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    const uint64_t size = static_cast<uint64_t>(st.st_size);
+
+    string   buf;         // partial line carried over, then the next chunk
+    uint64_t buf_off = 0; // file offset of buf[0]
+    Slot*    current = nullptr;
+    char     chunk[1 << 16];
+
+    for (uint64_t off = 0; off < size;) {
+        ssize_t r = ::read(fd, chunk, sizeof(chunk));
+        if (r < 0) {
+            return false;
+        }
+        off += static_cast<uint64_t>(r);
+        buf.append(chunk, static_cast<size_t>(r));
+        bool last = r == 0 || off >= size;
+
+        size_t begin = 0;
+        while (begin < buf.size()) {
+            size_t nl = buf.find('\n', begin);
+            if (nl == string::npos && !last) {
+                break;
+            }
+            size_t      end     = nl == string::npos ? buf.size() : nl;
+            string_view trimmed = trim(string_view(buf).substr(begin, end - begin));
+            uint64_t    next    = buf_off + (nl == string::npos ? end : nl + 1);
+
+            if (is_header(trimmed)) {
+                if (current) {
+                    current->blocks.back().second = buf_off + begin;
+                }
+                current = &slots[string(header_name(trimmed))];
+                current->blocks.emplace_back(next, size);
+            }
+            begin = nl == string::npos ? end : nl + 1;
+        }
+        buf.erase(0, begin);
+        buf_off += begin;
+
+        if (r == 0) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool LazyDocument::has_section(string_view section) const noexcept {
+    return slots.find(section) != slots.end();
+}
+
+// Gather the section's blocks under a single header and let Document do the
+// parsing and the resolution of repeated keys. Without merging only the
+// first block is read, which is what the streaming scan would see.
+shared_ptr<const Document> LazyDocument::materialize(string_view name, const Slot& slot) const {
+    string text;
+    text.reserve(name.size() + 3);
+    text.append("[").append(name).append("]\n");
+
+    for (const auto& [begin, end] : slot.blocks) {
+        size_t at = text.size();
+        text.resize(at + (end - begin) + 1);
+        if (!pread_full(fd, text.data() + at, end - begin, begin)) {
+            return nullptr;
+        }
+        text.back() = '\n';
+        if (merge == Merge::None) {
+            break;
+        }
+    }
+
+    auto doc = make_shared<Document>();
+    doc->parse(std::move(text), merge);
+    return doc;
+}
+
+// Drop least recently used sections until the cache fits the budget, but
+// always keep the most recent one
+void LazyDocument::evict() {
+    while (budget > 0 && resident > budget && lru.size() > 1) {
+        Slot* victim = lru.back();
+        lru.pop_back();
+        resident -= victim->charge;
+        victim->doc.reset();
+        victim->charge = 0;
+    }
+}
+
+shared_ptr<const Document> LazyDocument::section(string_view name) {
+    auto it = slots.find(name);
+    if (it == slots.end()) {
+        return nullptr;
+    }
+
+    lock_guard guard(lock);
+    Slot&      slot = it->second;
+    if (slot.doc) {
+        lru.splice(lru.begin(), lru, slot.lru);
+        return slot.doc;
+    }
+
+    slot.doc = materialize(it->first, slot);
+    if (!slot.doc) {
+        return nullptr;
+    }
+    slot.charge = 0;
+    for (const auto& [begin, end] : slot.blocks) {
+        slot.charge += end - begin;
+        if (merge == Merge::None) {
+            break;
+        }
+    }
+    resident += slot.charge;
+    lru.push_front(&slot);
+    slot.lru = lru.begin();
+    evict();
+    return slot.doc;
+}
+
+optional<string> LazyDocument::get(string_view section_name, string_view key) {
+    auto doc = section(section_name);
+    if (!doc) {
+        return nullopt;
+    }
+    auto value = doc->get(section_name, key);
+    return value ? optional<string>(*value) : nullopt;
+}
+
+size_t LazyDocument::resident_bytes() const {
+    lock_guard guard(lock);
+    return resident;
+}
@@ -0,0 +1,76 @@
+// Lazily materialized document for very large INI files.
+//
+// Opening a LazyDocument only pre-scans the file for section headers and
+// records where each block of each section starts and ends. A section's
+// entries are read and parsed on first access and cached as a one-section
+// Document. With a memory budget, the least recently used sections are
+// evicted once the cached text exceeds it and are simply re-read on their
+// next access.
+//
+// This sits between the streaming scan, which keeps nothing, and Document,
+// which parses everything up front.
+
+#pragma once
+
+#include "document.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class LazyDocument {
+public:
+    // memory_budget caps the bytes of section text kept cached; 0 means no cap
+    explicit LazyDocument(size_t memory_budget = 0)
+        : budget(memory_budget) { }
+    ~LazyDocument();
+
+    LazyDocument(const LazyDocument&)            = delete;
+    LazyDocument& operator=(const LazyDocument&) = delete;
+
+    // Pre-scan the file at path for section headers; returns false if it
+    // cannot be read. Must not race with lookups.
+    bool open(const std::filesystem::path& path, Merge merge = Merge::None);
+
+    [[nodiscard]] bool   has_section(std::string_view section) const noexcept;
+    [[nodiscard]] size_t section_count() const noexcept { return slots.size(); }
+
+    // The named section as a Document holding just that section, parsed on
+    // first access; null if there is no such section or it cannot be read.
+    // The returned document stays valid even if the cache evicts it.
+    [[nodiscard]] std::shared_ptr<const Document> section(std::string_view name);
+
+    // Raw value of key in section
+    [[nodiscard]] std::optional<std::string> get(std::string_view section, std::string_view key);
+
+    // Bytes of section text currently cached
+    [[nodiscard]] size_t resident_bytes() const;
+
+private:
+    struct Slot {
+        std::vector<std::pair<uint64_t, uint64_t>> blocks; // [begin, end) of each block's entries
+        std::shared_ptr<const Document>            doc;
+        size_t                                     charge = 0;
+        std::list<Slot*>::iterator                 lru;
+    };
+
+    std::shared_ptr<const Document> materialize(std::string_view name, const Slot& slot) const;
+    void                            evict();
+
+    size_t                                               budget;
+    int                                                  fd    = -1;
+    Merge                                                merge = Merge::None;
+    std::unordered_map<std::string, Slot, IHash, IEqual> slots;
+    std::list<Slot*>                                     lru; // most recently used first
+    size_t                                               resident = 0;
+    mutable std::mutex                                   lock;
+};
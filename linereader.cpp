@@ -0,0 +1,480 @@
+// Pluggable I/O backends for the streaming scan.
+
+#include "linereader.h"
+
+#include "trace.h"
+#include "uring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/vfs.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t read_block   = 256 * 1024;
+constexpr size_t direct_block = 1024 * 1024;
+constexpr size_t alignment    = 4096; // satisfies O_DIRECT on common devices
+
+constexpr size_t small_file = 64 * 1024;
+constexpr size_t huge_file  = size_t(1) << 30;
+
+// procfs and sysfs files report a size of 0 or 4096 whatever they produce
+bool pseudo_file(const struct statfs& fs) noexcept {
+    return fs.f_type == PROC_SUPER_MAGIC || fs.f_type == SYSFS_MAGIC;
+}
+
+// Network file systems, where every read waits for a round trip
+bool remote_file(const struct statfs& fs) noexcept {
+    switch (static_cast<uint32_t>(fs.f_type)) {
+    case NFS_SUPER_MAGIC:
+    case SMB_SUPER_MAGIC:
+    case CIFS_SUPER_MAGIC:
+    case SMB2_SUPER_MAGIC:
+    case CEPH_SUPER_MAGIC:
+    case V9FS_MAGIC:
+    case FUSE_SUPER_MAGIC:
+        return true;
+    }
+    return false;
+}
+
+// True if the block device holding st is a spinning disk, as far as sysfs
+// tells; a partition's queue is its disk's
+bool rotational_disk(const struct stat& st) {
+    char path[96];
+    for (const char* queue : {"queue", "../queue"}) {
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/%s/rotational", major(st.st_dev), minor(st.st_dev), queue);
+        if (FILE* f = fopen(path, "re")) {
+            int c = fgetc(f);
+            fclose(f);
+            return c == '1';
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+// Blocks are filled in turn by the I/O thread and handed back in the same
+// order by the scan. The scan holds at most one block at a time; the I/O
+// thread waits when the other slots are all filled, and the scan waits
+// when none is. A block is read in pieces of read_block bytes with a
+// check for stop between them, so that stopping waits for one piece of a
+// slow read at most, not for the whole block.
+struct LineReader::Pipeline {
+    static constexpr size_t slots = 4;
+
+    Pipeline(int file, char* buffers, size_t block)
+        : fd(file)
+        , buffers(buffers)
+        , block(block) {
+        io = thread([this] { run(); });
+    }
+
+    ~Pipeline() {
+        {
+            lock_guard guard(lock);
+            stopping = true;
+        }
+        freed.notify_one();
+        io.join();
+    }
+
+    // Hand back the block taken last, if any, and take the next one; false
+    // at the end of the file, with error set if a read failed
+    bool next(string_view& out, int& error) {
+        unique_lock guard(lock);
+        if (holding) {
+            ++released;
+            holding = false;
+            freed.notify_one();
+        }
+        ready.wait(guard, [&] { return filled > released || done; });
+        if (filled == released) {
+            error = read_error;
+            return false;
+        }
+        const size_t slot = released % slots;
+        out               = string_view(buffers + slot * block, lengths[slot]);
+        holding           = true;
+        return true;
+    }
+
+private:
+    void run() {
+        if (tracing()) {
+            trace_thread_name("io");
+        }
+        while (true) {
+            {
+                unique_lock guard(lock);
+                freed.wait(guard, [&] { return stopping || filled - released < slots; });
+                if (stopping) {
+                    return;
+                }
+            }
+            // Only this thread moves filled, so the slot is read unlocked
+            const size_t slot = filled % slots;
+            char* const  data = buffers + slot * block;
+            size_t       got  = 0;
+            ssize_t      n    = 0;
+            {
+                TraceScope trace("read");
+                while (got < block && !stopping) {
+                    n = ::read(fd, data + got, min(read_block, block - got));
+                    if (n > 0) {
+                        got += static_cast<size_t>(n);
+                    } else if (n == 0 || errno != EINTR) {
+                        break;
+                    }
+                }
+            }
+            if (stopping) {
+                return;
+            }
+            // A block cut short by the end or an error is handed on first;
+            // the next read sees the end or the error again
+            const int err = n < 0 ? errno : 0;
+            {
+                lock_guard guard(lock);
+                if (got == 0) {
+                    done       = true;
+                    read_error = err;
+                } else {
+                    lengths[slot] = got;
+                    ++filled;
+                }
+            }
+            ready.notify_one();
+            if (got == 0) {
+                return;
+            }
+        }
+    }
+
+    const int          fd;
+    char* const        buffers;
+    const size_t       block;
+    mutex              lock;
+    condition_variable ready; // a block was filled, or the end was reached
+    condition_variable freed; // a block was handed back, or stop
+    uint64_t           filled   = 0;
+    uint64_t           released = 0;
+    size_t             lengths[slots] {};
+    bool               holding    = false; // the scan has block released
+    bool               done       = false;
+    atomic<bool>       stopping   = false; // also read between the pieces of a block
+    int                read_error = 0;
+    thread             io;
+};
+
+const char* backend_name(IoBackend backend) noexcept {
+    switch (backend) {
+    case IoBackend::Auto:
+        return "auto";
+    case IoBackend::Stream:
+        return "stream";
+    case IoBackend::Read:
+        return "read";
+    case IoBackend::Mmap:
+        return "mmap";
+    case IoBackend::Direct:
+        return "direct";
+    case IoBackend::Uring:
+        return "uring";
+    case IoBackend::Pipeline:
+        return "pipeline";
+    }
+    return "?";
+}
+
+optional<IoBackend> parse_backend(string_view name) noexcept {
+    for (IoBackend b : {IoBackend::Auto, IoBackend::Stream, IoBackend::Read, IoBackend::Mmap, IoBackend::Direct,
+                        IoBackend::Uring, IoBackend::Pipeline}) {
+        if (name == backend_name(b)) {
+            return b;
+        }
+    }
+    return nullopt;
+}
+
+IoBackend choose_backend(const filesystem::path& path) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return IoBackend::Read;
+    }
+    struct statfs fs;
+    const bool    have_fs = ::statfs(path.c_str(), &fs) == 0;
+    if (have_fs && pseudo_file(fs)) {
+        return IoBackend::Read;
+    }
+    const auto size = static_cast<size_t>(st.st_size);
+    if (size < small_file) {
+        return IoBackend::Read;
+    }
+    if ((have_fs && remote_file(fs)) || rotational_disk(st)) {
+        return IoBackend::Pipeline;
+    }
+    if (size >= huge_file) {
+        return IoBackend::Direct;
+    }
+    return IoBackend::Mmap;
+}
+
+LineReader::LineReader() = default;
+
+LineReader::~LineReader() {
+    close();
+}
+
+void LineReader::close() {
+    pipeline.reset(); // stops its thread before the buffers go
+    if (in_flight) {
+        // The kernel may still write into buffer
+        uint64_t id;
+        int      res;
+        while (!ring->reap(id, res) && ring->submit(1)) {
+        }
+        in_flight = false;
+    }
+    ring.reset();
+    if (map) {
+        ::munmap(map, map_size);
+        map = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    free(buffer);
+    buffer = nullptr;
+    stream.close();
+    pending = {};
+    text.clear();
+    carried = false;
+    eof     = false;
+    error   = false;
+    offset  = 0;
+    current = 0;
+}
+
+bool LineReader::open(const filesystem::path& path, IoBackend backend) {
+    TraceScope trace("open");
+    close();
+    active = backend == IoBackend::Auto ? choose_backend(path) : backend;
+
+    if (active == IoBackend::Stream) {
+        stream.open(path, ios::binary);
+        return static_cast<bool>(stream);
+    }
+
+    const int flags = O_RDONLY | O_CLOEXEC;
+    if (active == IoBackend::Direct) {
+        fd = ::open(path.c_str(), flags | O_DIRECT);
+        if (fd < 0 && errno == EINVAL) {
+            active = IoBackend::Read; // tmpfs and some FUSE file systems
+        }
+    }
+    if (fd < 0) {
+        fd = ::open(path.c_str(), flags);
+    }
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        return false;
+    }
+    struct statfs fs;
+    if (active == IoBackend::Mmap && (!S_ISREG(st.st_mode) || (::fstatfs(fd, &fs) == 0 && pseudo_file(fs)))) {
+        active = IoBackend::Read;
+    }
+    if ((active == IoBackend::Uring || active == IoBackend::Pipeline) && !S_ISREG(st.st_mode)) {
+        active = IoBackend::Read;
+    }
+
+    if (active == IoBackend::Mmap) {
+        TraceScope mapping("mmap");
+        map_size = static_cast<size_t>(st.st_size);
+        if (map_size > 0) {
+            void* p = ::mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                return false;
+            }
+            map = static_cast<char*>(p);
+            ::madvise(map, map_size, MADV_SEQUENTIAL);
+        }
+        pending = string_view(map, map_size);
+        eof     = true;
+        return true;
+    }
+
+    block            = active == IoBackend::Direct || active == IoBackend::Pipeline ? direct_block : read_block;
+    const size_t len = active == IoBackend::Uring      ? 2 * block
+                       : active == IoBackend::Pipeline ? Pipeline::slots * block
+                                                       : block;
+    buffer           = static_cast<char*>(aligned_alloc(alignment, len));
+    if (!buffer) {
+        errno = ENOMEM;
+        return false;
+    }
+    if (active == IoBackend::Uring && !start_uring()) {
+        active = IoBackend::Read;
+    }
+    if (active == IoBackend::Pipeline) {
+        pipeline = make_unique<Pipeline>(fd, buffer, block);
+    }
+    return true;
+}
+
+// Set up the ring and put the first block in flight
+bool LineReader::start_uring() {
+    ring = make_unique<Uring>();
+    if (!ring->init(2) || !ring->prepare_read(fd, buffer, static_cast<unsigned>(block), 0, 0) || !ring->submit(0)) {
+        ring.reset();
+        return false;
+    }
+    in_flight = true;
+    return true;
+}
+
+bool LineReader::next(string_view& line) {
+    if (active == IoBackend::Stream) {
+        if (!getline(stream, text)) {
+            error = stream.bad();
+            return false;
+        }
+        line = text;
+        return true;
+    }
+
+    if (carried) {
+        text.clear();
+        carried = false;
+    }
+    while (true) {
+        if (size_t eol = pending.find('\n'); eol != string_view::npos) {
+            string_view head = pending.substr(0, eol);
+            pending.remove_prefix(eol + 1);
+            if (text.empty()) {
+                line = head;
+            } else {
+                text.append(head);
+                line    = text;
+                carried = true;
+            }
+            return true;
+        }
+        // The rest of the block starts a line that ends in the next one
+        text.append(pending);
+        pending = {};
+        if (!fill()) {
+            if (text.empty()) {
+                return false;
+            }
+            line    = text;
+            carried = true;
+            return true;
+        }
+    }
+}
+
+// Read the next block into pending; false at the end or on an error
+bool LineReader::fill() {
+    if (eof || error) {
+        return false;
+    }
+    TraceScope trace("read");
+    if (active == IoBackend::Uring) {
+        return fill_uring();
+    }
+    if (active == IoBackend::Pipeline) {
+        return fill_pipeline();
+    }
+
+    ssize_t n;
+    do {
+        n = active == IoBackend::Direct ? ::pread(fd, buffer, block, static_cast<off_t>(offset))
+                                        : ::read(fd, buffer, block);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 && errno == EINVAL && active == IoBackend::Direct && offset == 0) {
+        // O_DIRECT was accepted at open but not for this file or buffer
+        ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_DIRECT);
+        active = IoBackend::Read;
+        return fill();
+    }
+    if (n <= 0) {
+        error = n < 0;
+        eof   = true;
+        return false;
+    }
+    offset += static_cast<size_t>(n);
+    pending = string_view(buffer, static_cast<size_t>(n));
+    return true;
+}
+
+// Take the block in flight and start reading the one after it into the
+// other half of the buffer
+bool LineReader::fill_uring() {
+    if (!in_flight) {
+        // The ring was full or refused the last read; carry on without it
+        ::lseek(fd, static_cast<off_t>(offset), SEEK_SET);
+        active = IoBackend::Read;
+        return fill();
+    }
+
+    uint64_t id  = 0;
+    int      res = 0;
+    while (!ring->reap(id, res)) {
+        if (!ring->submit(1)) {
+            in_flight = false; // nothing more can be learned about it
+            error     = true;
+            return false;
+        }
+    }
+    in_flight = false;
+    if (res <= 0) {
+        errno = -res;
+        error = res < 0;
+        eof   = true;
+        return false;
+    }
+
+    char* filled = buffer + current * block;
+    offset += static_cast<size_t>(res);
+    current ^= 1;
+    if (ring->prepare_read(fd, buffer + current * block, static_cast<unsigned>(block), offset, 0)
+        && ring->submit(0)) {
+        in_flight = true;
+    }
+    pending = string_view(filled, static_cast<size_t>(res));
+    return true;
+}
+
+// Take the next block the I/O thread has read, handing back the last one
+bool LineReader::fill_pipeline() {
+    int err = 0;
+    if (pipeline->next(pending, err)) {
+        return true;
+    }
+    errno = err;
+    error = err != 0;
+    eof   = true;
+    return false;
+}
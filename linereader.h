@@ -0,0 +1,108 @@
+// Pluggable I/O backends for the streaming scan.
+//
+// LineReader hands out the lines of a file one at a time, read through one
+// of several backends:
+//
+//     stream   ifstream and getline, the scan's original way of reading
+//     read     read(2) into a 256 KiB buffer
+//     mmap     the whole file mapped read-only, with MADV_SEQUENTIAL
+//     direct   O_DIRECT reads of aligned 1 MiB blocks, past the page cache
+//     uring    io_uring reads of 256 KiB blocks, the next one in flight
+//              while the current one is scanned
+//     pipeline an I/O thread reading 1 MiB blocks ahead into a ring of four
+//              buffers, which the scan hands back as it finishes each one
+//
+// Except for stream, lines are views into the backend's buffer or mapping
+// and only a line split across two blocks is copied. The pipeline keeps
+// the reads of slow storage (network file systems, spinning disks) going
+// while the scan parses: the I/O thread waits when all buffers are full,
+// and the scan waits when all are empty.
+//
+// A backend that cannot work on a file falls back to read: mmap on pipes,
+// devices and procfs or sysfs files, direct where the file system refuses
+// O_DIRECT, uring on anything but a regular file or where io_uring is
+// missing or forbidden, and pipeline on anything but a regular file, where
+// a read can block for as long as the writer pleases.
+//
+// IoBackend::Auto leaves the choice to choose_backend(), which looks at the
+// file type, its size and the storage it is on.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+class Uring;
+
+enum class IoBackend : uint8_t { Auto, Stream, Read, Mmap, Direct, Uring, Pipeline };
+
+[[nodiscard]] const char* backend_name(IoBackend backend) noexcept;
+
+// Backend named name, as printed by backend_name()
+[[nodiscard]] std::optional<IoBackend> parse_backend(std::string_view name) noexcept;
+
+// The backend Auto stands for when path is to be scanned:
+//
+//     pipes, sockets, devices, procfs and sysfs   read
+//     regular files under 64 KiB                  read
+//     files on network file systems or
+//     spinning disks                              pipeline
+//     regular files of 1 GiB and more             direct
+//     other regular files                         mmap
+[[nodiscard]] IoBackend choose_backend(const std::filesystem::path& path);
+
+class LineReader {
+public:
+    LineReader();
+    ~LineReader();
+
+    LineReader(const LineReader&)            = delete;
+    LineReader& operator=(const LineReader&) = delete;
+
+    // Open path for reading through backend; false if it cannot be opened,
+    // with errno set
+    bool open(const std::filesystem::path& path, IoBackend backend = IoBackend::Auto);
+
+    // Next line, without its '\n'; the view is valid until the next call.
+    // False at the end of the file or on a read error.
+    bool next(std::string_view& line);
+
+    // True if reading stopped at an error rather than at the end
+    [[nodiscard]] bool failed() const noexcept { return error; }
+
+    // The backend in use, after Auto and any fallback were resolved
+    [[nodiscard]] IoBackend backend() const noexcept { return active; }
+
+private:
+    struct Pipeline; // the I/O thread and its buffers
+
+    bool fill();
+    bool fill_uring();
+    bool fill_pipeline();
+    bool start_uring();
+    void close();
+
+    IoBackend                 active = IoBackend::Stream;
+    std::ifstream             stream;
+    int                       fd        = -1;
+    char*                     map       = nullptr;
+    size_t                    map_size  = 0;
+    char*                     buffer    = nullptr; // aligned, two blocks for uring, four for pipeline
+    size_t                    block     = 0;
+    unsigned                  current   = 0;       // uring block being filled next
+    bool                      in_flight = false;   // a uring read is outstanding
+    uint64_t                  offset    = 0;       // of the next read
+    std::unique_ptr<Uring>    ring;
+    std::unique_ptr<Pipeline> pipeline;
+    std::string_view          pending;             // unread part of the last block
+    std::string               text;                // getline's line, or a split line
+    bool                      carried = false;     // the last line handed out was text
+    bool                      eof     = false;
+    bool                      error   = false;
+};
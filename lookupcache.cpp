@@ -0,0 +1,76 @@
+// Per-thread caches of lookup results for the server.
+
+#include "lookupcache.h"
+
+#include <utility>
+
+using namespace std;
+
+LookupCache::LookupCache(size_t sets) {
+    size_t n = 1;
+    while (n < sets) {
+        n *= 2;
+    }
+    hits.resize(2 * n);
+    misses.resize(2 * n);
+    mask = n - 1;
+}
+
+// The line holding the answer in its set, moved to the front of the set
+LookupCache::Line* LookupCache::find(vector<Line>& table, uint64_t serial, uint64_t section_hash,
+                                     uint64_t key_hash) noexcept {
+    Line* set = &table[2 * ((section_hash ^ (key_hash * 0x9E3779B97F4A7C15ull)) & mask)];
+    for (int way = 0; way < 2; ++way) {
+        Line& line = set[way];
+        if (line.serial == serial && line.section_hash == section_hash && line.key_hash == key_hash) {
+            if (way == 1) {
+                swap(set[0], set[1]);
+            }
+            return &set[0];
+        }
+    }
+    return nullptr;
+}
+
+// Insert at the front of the set, pushing out its least recently used line
+void LookupCache::insert(vector<Line>& table, const Line& line) noexcept {
+    Line* set = &table[2 * ((line.section_hash ^ (line.key_hash * 0x9E3779B97F4A7C15ull)) & mask)];
+    set[1]    = set[0];
+    set[0]    = line;
+}
+
+optional<string_view> LookupCache::get(const Document& doc, string_view section, uint64_t section_hash,
+                                       string_view key, uint64_t key_hash) {
+    bump(lookup_count);
+    const uint64_t serial = doc.serial();
+
+    if (const Line* line = find(hits, serial, section_hash, key_hash)) {
+        bump(hit_count);
+        bump(found_count);
+        return string_view(line->value, line->length);
+    }
+    if (find(misses, serial, section_hash, key_hash)) {
+        bump(negative_hit_count);
+        return nullopt;
+    }
+
+    // Only answers for hashes that belong to their names are kept, so a
+    // client sending made-up hashes cannot plant entries others would hit
+    optional<string_view> value = doc.get(section, section_hash, key, key_hash);
+    if (ihash(section) == section_hash && ihash(key) == key_hash) {
+        if (value) {
+            insert(hits, Line { section_hash, key_hash, serial, value->data(), value->size() });
+        } else {
+            insert(misses, Line { section_hash, key_hash, serial, nullptr, 0 });
+        }
+    }
+    if (value) {
+        bump(found_count);
+    }
+    return value;
+}
+
+LookupCache::Counters LookupCache::counters() const noexcept {
+    return Counters { lookup_count.load(memory_order_relaxed), found_count.load(memory_order_relaxed),
+                      hit_count.load(memory_order_relaxed), negative_hit_count.load(memory_order_relaxed) };
+}
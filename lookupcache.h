@@ -0,0 +1,75 @@
+// Per-thread caches of lookup results for the server.
+//
+// Real traffic is skewed: a few keys take most lookups, and many lookups
+// are for keys that do not exist. A LookupCache sits in front of a
+// Document and remembers recent answers in two small tables, one for hits
+// and one for misses, so that a stream of misses cannot push the hot keys
+// out. A cached answer costs one hash-indexed load and a few integer
+// compares; misses in particular stop costing KeyPool probes and name
+// compares.
+//
+// Entries are matched by the ihash() of both names, which makes a false
+// match a 128-bit collision, and by the document's serial number, so that
+// every entry goes stale the moment a new document is published. Names are
+// not compared on a cache hit, so a caller passing hashes that do not
+// belong to its names may get the answer for the names they do belong to.
+// Entries are only made from hashes checked against their names.
+//
+// A cache belongs to one thread. Its counters are written by that thread
+// only and may be read from any other.
+
+#pragma once
+
+#include "document.h"
+
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+class LookupCache {
+public:
+    struct Counters {
+        uint64_t lookups       = 0;
+        uint64_t found         = 0; // lookups that found a value, cached or not
+        uint64_t hits          = 0; // answered from the hit table
+        uint64_t negative_hits = 0; // answered from the miss table
+    };
+
+    // Tables of the given number of two-way sets each, rounded up to a
+    // power of two
+    explicit LookupCache(size_t sets = 1024);
+
+    // Value of key in section of doc, through the cache
+    [[nodiscard]] std::optional<std::string_view> get(const Document& doc, std::string_view section,
+                                                      uint64_t section_hash, std::string_view key, uint64_t key_hash);
+
+    [[nodiscard]] Counters counters() const noexcept;
+
+private:
+    struct Line {
+        uint64_t    section_hash = 0;
+        uint64_t    key_hash     = 0;
+        uint64_t    serial       = 0; // 0 marks an empty line
+        const char* value        = nullptr;
+        size_t      length       = 0;
+    };
+
+    [[nodiscard]] Line* find(std::vector<Line>& table, uint64_t serial, uint64_t section_hash,
+                             uint64_t key_hash) noexcept;
+    void insert(std::vector<Line>& table, const Line& line) noexcept;
+
+    static void bump(std::atomic<uint64_t>& counter) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::vector<Line> hits;   // two lines per set, most recently used first
+    std::vector<Line> misses; // the same, for keys that were not found
+    size_t            mask;   // sets - 1
+
+    alignas(64) std::atomic<uint64_t> lookup_count {0};
+    std::atomic<uint64_t>             found_count {0};
+    std::atomic<uint64_t>             hit_count {0};
+    std::atomic<uint64_t>             negative_hit_count {0};
+};
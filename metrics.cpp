@@ -0,0 +1,118 @@
+// Metrics in the Prometheus text exposition format.
+
+#include "metrics.h"
+
+#include "editor.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+void write_header(string& out, string_view name, string_view type, string_view help) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void write_value(string& out, double value) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", value);
+    out.append(buf);
+}
+
+} // namespace
+
+Histogram::Counts& Histogram::Counts::operator+=(const Counts& other) noexcept {
+    for (size_t i = 0; i < bucket.size(); ++i) {
+        bucket[i] += other.bucket[i];
+    }
+    count += other.count;
+    sum_ns += other.sum_ns;
+    return *this;
+}
+
+void Histogram::observe(chrono::nanoseconds elapsed) noexcept {
+    const uint64_t ns = static_cast<uint64_t>(max<int64_t>(0, elapsed.count()));
+    const uint64_t us = (ns + 999) / 1000;
+    const int      i  = us <= 1 ? 0 : bit_width(us - 1); // smallest i with us <= 2^i
+    bump(bucket[static_cast<size_t>(min(i, buckets))]);
+    bump(count);
+    bump(sum_ns, ns);
+}
+
+Histogram::Counts Histogram::counts() const noexcept {
+    Counts c;
+    for (size_t i = 0; i < bucket.size(); ++i) {
+        c.bucket[i] = bucket[i].load(memory_order_relaxed);
+    }
+    c.count  = count.load(memory_order_relaxed);
+    c.sum_ns = sum_ns.load(memory_order_relaxed);
+    return c;
+}
+
+void write_counter(string& out, string_view name, string_view help, uint64_t value) {
+    write_header(out, name, "counter", help);
+    out.append(name).append(" ").append(to_string(value)).append("\n");
+}
+
+void write_gauge(string& out, string_view name, string_view help, double value) {
+    write_header(out, name, "gauge", help);
+    out.append(name).append(" ");
+    write_value(out, value);
+    out.append("\n");
+}
+
+void write_histogram(string& out, string_view name, string_view help, const Histogram::Counts& counts) {
+    write_header(out, name, "histogram", help);
+    // Buckets are read one at a time while being written, so the total is
+    // taken from them to keep the cumulative counts consistent
+    uint64_t total = 0;
+    for (int i = 0; i <= Histogram::buckets; ++i) {
+        total += counts.bucket[static_cast<size_t>(i)];
+        out.append(name).append("_bucket{le=\"");
+        if (i == Histogram::buckets) {
+            out.append("+Inf");
+        } else {
+            write_value(out, static_cast<double>(uint64_t(1) << i) / 1e6);
+        }
+        out.append("\"} ").append(to_string(total)).append("\n");
+    }
+    out.append(name).append("_sum ");
+    write_value(out, static_cast<double>(counts.sum_ns) / 1e9);
+    out.append("\n").append(name).append("_count ").append(to_string(total)).append("\n");
+}
+
+bool write_textfile(const filesystem::path& path, string_view text) {
+    return replace_contents(path, [&](int fd) {
+        const char* data = text.data();
+        size_t      left = text.size();
+        while (left > 0) {
+            ssize_t n = ::write(fd, data, left);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            data += n;
+            left -= static_cast<size_t>(n);
+        }
+        return true;
+    });
+}
+
+uint64_t resident_bytes() {
+    ifstream statm("/proc/self/statm");
+    uint64_t size     = 0;
+    uint64_t resident = 0;
+    if (!(statm >> size >> resident)) {
+        return 0;
+    }
+    return resident * static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+}
@@ -0,0 +1,60 @@
+// Metrics in the Prometheus text exposition format.
+//
+// Counters that sit on a lookup path are kept per thread, written only by
+// their own thread and summed when the metrics are rendered, so recording
+// never bounces a shared cache line between cores. Histograms follow the
+// same rule. The helpers here render the exposition text and write it for
+// node_exporter's textfile collector.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// Latency histogram with power-of-two buckets, from 1 us up to about 16 s.
+// One thread observes; any thread may read the counts.
+class Histogram {
+public:
+    static constexpr int buckets = 25; // upper bounds 2^i us, i = 0..24
+
+    struct Counts {
+        std::array<uint64_t, buckets + 1> bucket {}; // the last one is +Inf
+        uint64_t                          count  = 0;
+        uint64_t                          sum_ns = 0;
+
+        Counts& operator+=(const Counts& other) noexcept;
+    };
+
+    void observe(std::chrono::nanoseconds elapsed) noexcept;
+
+    [[nodiscard]] Counts counts() const noexcept;
+
+private:
+    static void bump(std::atomic<uint64_t>& counter, uint64_t by = 1) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    alignas(64) std::array<std::atomic<uint64_t>, buckets + 1> bucket {};
+    std::atomic<uint64_t>                                      count {0};
+    std::atomic<uint64_t>                                      sum_ns {0};
+};
+
+// Append one counter or gauge, with its HELP and TYPE lines, to out
+void write_counter(std::string& out, std::string_view name, std::string_view help, uint64_t value);
+void write_gauge(std::string& out, std::string_view name, std::string_view help, double value);
+
+// Append a histogram in seconds, with cumulative buckets, to out
+void write_histogram(std::string& out, std::string_view name, std::string_view help, const Histogram::Counts& counts);
+
+// Replace the file at path with text through replace_contents() (see
+// editor.h), so a scraper never sees half of it; false on failure, with
+// errno set
+bool write_textfile(const std::filesystem::path& path, std::string_view text);
+
+// Resident set size of this process in bytes, 0 if unknown
+[[nodiscard]] uint64_t resident_bytes();
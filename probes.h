@@ -0,0 +1,43 @@
+// Static tracepoints (USDT) in the parse and lookup paths.
+//
+// Where <sys/sdt.h> is available (systemtap-sdt-dev, systemtap-sdt-devel)
+// every probe compiles to a single nop plus an ELF note describing where
+// its arguments live, so an unattached probe costs nothing measurable.
+// perf, bpftrace or SystemTap can attach to a running binary without a
+// rebuild, for example
+//
+//     bpftrace -e 'usdt:./inireader:inireader:lookup__start { @t[tid] = nsecs; }
+//                  usdt:./inireader:inireader:lookup__done  { @ns = hist(nsecs - @t[tid]); }'
+//
+// Without the header, or with INIREADER_NO_PROBES defined, the macros
+// expand to nothing and their arguments are not evaluated.
+//
+// Probes of provider "inireader", with their arguments:
+//
+//     lookup__start    path, section, key           (C strings)
+//     file__open       path, ok                     file opened for a scan, or loaded
+//     section__match   name, name length, line      header of the wanted section
+//     entry__parse     key, key length, line        entry parsed in the wanted section
+//     key__match       value, value length          the wanted key was found
+//     lookup__done     exit status
+//     parse__start     text bytes                   Document::parse() begins
+//     parse__done      sections, distinct keys
+
+#pragma once
+
+#if defined(__has_include) && !defined(INIREADER_NO_PROBES)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define INIREADER_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef INIREADER_HAVE_PROBES
+#define INI_PROBE1(name, a)          DTRACE_PROBE1(inireader, name, a)
+#define INI_PROBE2(name, a, b)       DTRACE_PROBE2(inireader, name, a, b)
+#define INI_PROBE3(name, a, b, c)    DTRACE_PROBE3(inireader, name, a, b, c)
+#else
+#define INI_PROBE1(name, a)          do { } while (0)
+#define INI_PROBE2(name, a, b)       do { } while (0)
+#define INI_PROBE3(name, a, b, c)    do { } while (0)
+#endif
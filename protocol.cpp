@@ -0,0 +1,172 @@
+// Binary request protocol for the lookup server.
+
+#include "protocol.h"
+
+#include "ini.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+constexpr uint8_t kind_request  = 'Q';
+constexpr uint8_t kind_response = 'R';
+constexpr size_t  lookup_fixed  = 20; // hashes and name lengths
+
+// Store the low bytes of v at p, little-endian; returns the end
+char* put(char* p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        p[i] = static_cast<char>(v >> (8 * i));
+    }
+    return p + bytes;
+}
+
+// Write a frame header at p
+char* put_header(char* p, uint8_t kind, size_t count, uint64_t length) {
+    p = put(p, frame_magic, 1);
+    p = put(p, kind, 1);
+    p = put(p, count, 2);
+    return put(p, length, 4);
+}
+
+uint64_t get(const char* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        v = (v << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return v;
+}
+
+// Check the header at the start of in; on Complete, body is the frame's
+// body and count its item count
+FrameStatus frame(string_view in, uint8_t kind, uint32_t max_body, string_view& body, uint16_t& count) {
+    if (in.size() < frame_header) {
+        return in.empty() || static_cast<uint8_t>(in[0]) == frame_magic ? FrameStatus::Incomplete
+                                                                       : FrameStatus::Malformed;
+    }
+    uint32_t length = static_cast<uint32_t>(get(in.data() + 4, 4));
+    if (static_cast<uint8_t>(in[0]) != frame_magic || static_cast<uint8_t>(in[1]) != kind || length > max_body) {
+        return FrameStatus::Malformed;
+    }
+    if (in.size() - frame_header < length) {
+        return FrameStatus::Incomplete;
+    }
+    count = static_cast<uint16_t>(get(in.data() + 2, 2));
+    body  = in.substr(frame_header, length);
+    return FrameStatus::Complete;
+}
+
+} // namespace
+
+void encode_request(const vector<Lookup>& lookups, string& out) {
+    size_t body = 0;
+    for (const Lookup& l : lookups) {
+        body += lookup_fixed + l.section.size() + l.key.size();
+    }
+
+    const size_t start = out.size();
+    out.resize(start + frame_header + body);
+    char* p = put_header(out.data() + start, kind_request, lookups.size(), body);
+    for (const Lookup& l : lookups) {
+        p = put(p, ihash(l.section), 8);
+        p = put(p, ihash(l.key), 8);
+        p = put(p, l.section.size(), 2);
+        p = put(p, l.key.size(), 2);
+        p = copy(l.section.begin(), l.section.end(), p);
+        p = copy(l.key.begin(), l.key.end(), p);
+    }
+}
+
+FrameStatus decode_request(string_view in, vector<Lookup>& lookups, size_t& size) {
+    string_view body;
+    uint16_t    count  = 0;
+    FrameStatus status = frame(in, kind_request, frame_max_body, body, count);
+    if (status != FrameStatus::Complete) {
+        return status;
+    }
+
+    lookups.clear();
+    lookups.reserve(count);
+    size = frame_header + body.size();
+    for (uint16_t i = 0; i < count; ++i) {
+        if (body.size() < lookup_fixed) {
+            return FrameStatus::Malformed;
+        }
+        Lookup l;
+        l.section_hash       = get(body.data(), 8);
+        l.key_hash           = get(body.data() + 8, 8);
+        size_t section_bytes = get(body.data() + 16, 2);
+        size_t key_bytes     = get(body.data() + 18, 2);
+        body.remove_prefix(lookup_fixed);
+        if (body.size() < section_bytes + key_bytes) {
+            return FrameStatus::Malformed;
+        }
+        l.section = body.substr(0, section_bytes);
+        l.key     = body.substr(section_bytes, key_bytes);
+        body.remove_prefix(section_bytes + key_bytes);
+        lookups.push_back(l);
+    }
+    return body.empty() ? FrameStatus::Complete : FrameStatus::Malformed;
+}
+
+void encode_response(const vector<optional<string_view>>& values, string& headers, vector<iovec>& iov) {
+    uint64_t body = 0;
+    for (const optional<string_view>& v : values) {
+        body += 4 + (v ? v->size() : 0);
+    }
+
+    // Every header is written before the first iovec points into headers
+    const size_t start = headers.size();
+    headers.resize(start + frame_header + 4 * values.size());
+    char* p = put_header(headers.data() + start, kind_response, values.size(), body);
+    for (const optional<string_view>& v : values) {
+        p = put(p, v ? v->size() : frame_not_found, 4);
+    }
+
+    const char* h = headers.data() + start;
+    iov.push_back(iovec { const_cast<char*>(h), frame_header });
+    h += frame_header;
+    for (const optional<string_view>& v : values) {
+        // Headers with no value bytes between them share one iovec
+        if (static_cast<const char*>(iov.back().iov_base) + iov.back().iov_len == h) {
+            iov.back().iov_len += 4;
+        } else {
+            iov.push_back(iovec { const_cast<char*>(h), 4 });
+        }
+        if (v && !v->empty()) {
+            iov.push_back(iovec { const_cast<char*>(v->data()), v->size() });
+        }
+        h += 4;
+    }
+}
+
+FrameStatus decode_response(string_view in, vector<optional<string_view>>& values, size_t& size) {
+    string_view body;
+    uint16_t    count  = 0;
+    FrameStatus status = frame(in, kind_response, UINT32_MAX, body, count);
+    if (status != FrameStatus::Complete) {
+        return status;
+    }
+
+    values.clear();
+    values.reserve(count);
+    size = frame_header + body.size();
+    for (uint16_t i = 0; i < count; ++i) {
+        if (body.size() < 4) {
+            return FrameStatus::Malformed;
+        }
+        uint32_t length = static_cast<uint32_t>(get(body.data(), 4));
+        body.remove_prefix(4);
+        if (length == frame_not_found) {
+            values.emplace_back();
+            continue;
+        }
+        if (body.size() < length) {
+            return FrameStatus::Malformed;
+        }
+        values.emplace_back(body.substr(0, length));
+        body.remove_prefix(length);
+    }
+    return body.empty() ? FrameStatus::Complete : FrameStatus::Malformed;
+}
@@ -0,0 +1,76 @@
+// Binary request protocol for the lookup server.
+//
+// The text protocol (see server.h) spends a real share of every request on
+// tokenizing and hashing names. Binary frames carry a batch of lookups with
+// each name's ihash() already computed, so the server goes straight to its
+// tables. The names travel too and are compared whenever the document is
+// probed; answers the server has cached are matched on the hashes alone
+// (see lookupcache.h).
+//
+// All integers are little-endian. A frame is an 8-byte header followed by
+// its body:
+//
+//     u8  magic      0xB1, which no text request can start with
+//     u8  kind       'Q' for a request, 'R' for a response
+//     u16 count      lookups in the batch
+//     u32 length     bytes of body that follow
+//
+// A request body holds count lookups, each
+//
+//     u64 section hash, u64 key hash, u16 section length, u16 key length,
+//     section name, key name
+//
+// and the response body one result per lookup, in order, each
+//
+//     u32 value length, or 0xFFFFFFFF if the key was not found, then the value
+//
+// Text and binary requests can be mixed on one connection; responses come
+// back in request order.
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <vector>
+
+constexpr uint8_t  frame_magic     = 0xB1;
+constexpr size_t   frame_header    = 8;
+constexpr uint32_t frame_max_body  = 16 * 1024 * 1024;
+constexpr uint16_t frame_max_count = UINT16_MAX;
+constexpr uint32_t frame_not_found = UINT32_MAX;
+
+struct Lookup {
+    std::string_view section;
+    std::string_view key;
+    uint64_t         section_hash = 0;
+    uint64_t         key_hash     = 0;
+};
+
+enum class FrameStatus {
+    Complete,   // a whole frame was decoded
+    Incomplete, // more bytes are needed
+    Malformed,  // not a valid frame; the stream cannot be resynchronized
+};
+
+// Append a request frame for lookups to out, hashing the names. At most
+// frame_max_count lookups fit in one frame, and names must be shorter than
+// 64 KiB.
+void encode_request(const std::vector<Lookup>& lookups, std::string& out);
+
+// Decode the request frame at the start of in. On Complete, lookups holds
+// views into in and size the frame's length.
+[[nodiscard]] FrameStatus decode_request(std::string_view in, std::vector<Lookup>& lookups, size_t& size);
+
+// Lay out a response frame for values as iovecs, without copying them: the
+// frame and per-value headers go into headers, which must not change until
+// the iovecs are written, and the value bytes are referenced where they are.
+void encode_response(const std::vector<std::optional<std::string_view>>& values, std::string& headers,
+                     std::vector<iovec>& iov);
+
+// Decode the response frame at the start of in. On Complete, values holds
+// views into in and size the frame's length.
+[[nodiscard]] FrameStatus decode_response(std::string_view in, std::vector<std::optional<std::string_view>>& values,
+                                          size_t& size);
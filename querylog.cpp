@@ -0,0 +1,135 @@
+// Binary log of lookups, for studying and replaying real access patterns.
+
+#include "querylog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr size_t record_fixed = 20;        // everything before the names
+constexpr size_t buffer_limit = 64 * 1024; // buffered bytes before a write
+constexpr auto   write_period = chrono::seconds(1);
+
+char* put(char* p, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        p[i] = static_cast<char>(v >> (8 * i));
+    }
+    return p + bytes;
+}
+
+uint64_t get(const char* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+        v = (v << 8) | static_cast<unsigned char>(p[i]);
+    }
+    return v;
+}
+
+} // namespace
+
+QueryLog::~QueryLog() {
+    if (fd >= 0) {
+        flush();
+        ::close(fd);
+    }
+}
+
+bool QueryLog::open(const filesystem::path& path) {
+    int f = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (f < 0) {
+        return false;
+    }
+    if (fd >= 0) {
+        flush();
+        ::close(fd);
+    }
+    fd         = f;
+    last_write = chrono::steady_clock::now();
+    return true;
+}
+
+void QueryLog::record(string_view path, string_view section, string_view key, bool found,
+                      chrono::nanoseconds latency) {
+    if (fd < 0 || path.size() > UINT16_MAX || section.size() > UINT16_MAX || key.size() > UINT16_MAX) {
+        return;
+    }
+    const auto now  = chrono::system_clock::now().time_since_epoch();
+    const auto nsec = max<int64_t>(0, latency.count());
+
+    const size_t start = buffer.size();
+    buffer.resize(start + record_fixed + path.size() + section.size() + key.size());
+    char* p = buffer.data() + start;
+    p       = put(p, query_log_magic, 1);
+    p       = put(p, found ? 1 : 0, 1);
+    p       = put(p, path.size(), 2);
+    p       = put(p, section.size(), 2);
+    p       = put(p, key.size(), 2);
+    p       = put(p, static_cast<uint64_t>(min<int64_t>(nsec, UINT32_MAX)), 4);
+    p       = put(p, static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(now).count()), 8);
+    p       = copy(path.begin(), path.end(), p);
+    p       = copy(section.begin(), section.end(), p);
+    copy(key.begin(), key.end(), p);
+
+    if (buffer.size() >= buffer_limit || chrono::steady_clock::now() - last_write >= write_period) {
+        flush();
+    }
+}
+
+bool QueryLog::flush() {
+    last_write = chrono::steady_clock::now();
+    if (fd < 0 || buffer.empty()) {
+        return true;
+    }
+    // One write per batch keeps concurrent appenders from splitting records
+    ssize_t n = ::write(fd, buffer.data(), buffer.size());
+    buffer.clear();
+    return n >= 0;
+}
+
+bool read_query_log(const filesystem::path& path, string& text, vector<LoggedQuery>& queries) {
+    ifstream file(path, ios::binary);
+    if (!file) {
+        return false;
+    }
+    text.clear();
+    char block[64 * 1024];
+    while (file.read(block, sizeof(block)) || file.gcount() > 0) {
+        text.append(block, static_cast<size_t>(file.gcount()));
+    }
+    if (file.bad()) {
+        return false;
+    }
+
+    queries.clear();
+    string_view rest(text);
+    while (rest.size() >= record_fixed) {
+        const char* p = rest.data();
+        if (static_cast<uint8_t>(p[0]) != query_log_magic) {
+            errno = EINVAL;
+            return false;
+        }
+        size_t path_length    = get(p + 2, 2);
+        size_t section_length = get(p + 4, 2);
+        size_t key_length     = get(p + 6, 2);
+        size_t size           = record_fixed + path_length + section_length + key_length;
+        if (rest.size() < size) {
+            break; // torn by a writer that died
+        }
+
+        LoggedQuery& q = queries.emplace_back();
+        q.found        = (p[1] & 1) != 0;
+        q.latency_ns   = static_cast<uint32_t>(get(p + 8, 4));
+        q.time_ns      = get(p + 12, 8);
+        q.path         = rest.substr(record_fixed, path_length);
+        q.section      = rest.substr(record_fixed + path_length, section_length);
+        q.key          = rest.substr(record_fixed + path_length + section_length, key_length);
+        rest.remove_prefix(size);
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+// Binary log of lookups, for studying and replaying real access patterns.
+//
+// Each record is one lookup: the file it was made against, the section and
+// key, whether a value was found and how long the lookup took. The command
+// line appends a record per run with --log=<file>, and the server one per
+// lookup it answers (see server.h), so a day of traffic can be captured and
+// later replayed against any engine with bench/query_replay.
+//
+// Records are self-contained, so any number of processes can append to one
+// log. All integers are little-endian:
+//
+//     u8  magic      0xA7
+//     u8  flags      bit 0 set if the key was found
+//     u16 path length
+//     u16 section length
+//     u16 key length
+//     u32 latency    nanoseconds, saturating
+//     u64 time       nanoseconds since the Unix epoch
+//
+// followed by the path, the section and the key. A record whose names do
+// not fit their length fields is not logged.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+constexpr uint8_t query_log_magic = 0xA7;
+
+struct LoggedQuery {
+    std::string_view path;
+    std::string_view section;
+    std::string_view key;
+    bool             found      = false;
+    uint32_t         latency_ns = 0;
+    uint64_t         time_ns    = 0;
+};
+
+// Appends records to a log. Records are buffered and reach the file in
+// single O_APPEND writes of whole records: when the buffer fills, at least
+// once a second while records keep coming, and on flush() or destruction.
+// One QueryLog belongs to one thread; threads sharing a log file each open
+// their own.
+class QueryLog {
+public:
+    QueryLog() = default;
+    ~QueryLog();
+
+    QueryLog(const QueryLog&)            = delete;
+    QueryLog& operator=(const QueryLog&) = delete;
+
+    // Open the log at path for appending, creating it if needed; false on
+    // failure, with errno set
+    bool open(const std::filesystem::path& path);
+
+    [[nodiscard]] bool is_open() const noexcept { return fd >= 0; }
+
+    void record(std::string_view path, std::string_view section, std::string_view key, bool found,
+                std::chrono::nanoseconds latency);
+
+    // Write out buffered records; false on a write error, with errno set
+    bool flush();
+
+private:
+    int                                   fd = -1;
+    std::string                           buffer;
+    std::chrono::steady_clock::time_point last_write;
+};
+
+// Read every record of the log at path into queries, whose views point into
+// text. A torn record at the end, left by a writer that died mid-write, is
+// ignored. False if the file cannot be read (errno set) or holds something
+// that is not a record (EINVAL).
+bool read_query_log(const std::filesystem::path& path, std::string& text, std::vector<LoggedQuery>& queries);
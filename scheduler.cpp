@@ -0,0 +1,169 @@
+// A work-stealing pool of threads for jobs of very uneven size.
+
+#include "scheduler.h"
+
+#include <chrono>
+#include <deque>
+
+using namespace std;
+
+namespace {
+
+// The pool and the worker the calling thread runs for, if any
+thread_local const Scheduler* current_pool   = nullptr;
+thread_local unsigned         current_worker = 0;
+
+int64_t now_ns() noexcept {
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+struct Scheduler::Worker {
+    mutex            lock; // guards tasks
+    deque<Task>      tasks;
+    atomic<uint64_t> ran {0};
+    atomic<uint64_t> stolen {0};
+    atomic<int64_t>  idle_ns {0};
+    atomic<int64_t>  asleep_since {0}; // steady clock, 0 while awake
+};
+
+Scheduler::Scheduler(unsigned count, size_t backlog)
+    : backlog(max<size_t>(backlog, 1)) {
+    for (unsigned i = 0; i < count; ++i) {
+        workers.push_back(make_unique<Worker>());
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        threads.emplace_back([this, i] { run(i); });
+    }
+}
+
+Scheduler::~Scheduler() {
+    wait();
+    {
+        lock_guard guard(lock);
+        stopping = true;
+    }
+    work.notify_all();
+    for (auto& t : threads) {
+        t.join();
+    }
+}
+
+void Scheduler::submit(Task task) {
+    if (workers.empty()) {
+        task();
+        return;
+    }
+    {
+        unique_lock guard(lock);
+        room.wait(guard, [&] { return queued.load() < backlog; });
+    }
+    queue(std::move(task), turn.fetch_add(1, memory_order_relaxed) % workers.size());
+}
+
+void Scheduler::spawn(Task task) {
+    if (workers.empty()) {
+        task();
+        return;
+    }
+    queue(std::move(task), current_pool == this ? current_worker
+                                                : turn.fetch_add(1, memory_order_relaxed) % workers.size());
+}
+
+void Scheduler::wait() {
+    unique_lock guard(lock);
+    idle.wait(guard, [&] { return unfinished.load() == 0; });
+}
+
+SchedulerStats Scheduler::stats() const noexcept {
+    const int64_t  now     = now_ns();
+    int64_t        idle_ns = 0;
+    SchedulerStats s;
+    s.workers = static_cast<unsigned>(workers.size());
+    for (const auto& w : workers) {
+        s.tasks += w->ran.load(memory_order_relaxed);
+        s.steals += w->stolen.load(memory_order_relaxed);
+        idle_ns += w->idle_ns.load(memory_order_relaxed);
+        // A worker asleep now has been idle since it went to sleep
+        if (int64_t since = w->asleep_since.load(memory_order_relaxed)) {
+            idle_ns += now - since;
+        }
+    }
+    s.idle_seconds = static_cast<double>(idle_ns) / 1e9;
+    return s;
+}
+
+void Scheduler::queue(Task task, unsigned worker) {
+    unfinished.fetch_add(1);
+    {
+        Worker&    w = *workers[worker];
+        lock_guard guard(w.lock);
+        w.tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1);
+    // A worker counts itself a sleeper before it checks queued, so one of
+    // the two sees the other. Taking the lock makes sure a sleeper that saw
+    // no task is waiting before the notification.
+    if (sleepers.load() > 0) {
+        lock.lock();
+        lock.unlock();
+        work.notify_one();
+    }
+}
+
+// Take the newest task of worker self, or else the oldest of another
+bool Scheduler::take(unsigned self, Task& task) {
+    const size_t n     = workers.size();
+    bool         found = false;
+    for (size_t i = 0; i < n && !found; ++i) {
+        Worker&    w = *workers[(self + i) % n];
+        lock_guard guard(w.lock);
+        if (w.tasks.empty()) {
+            continue;
+        }
+        if (i == 0) {
+            task = std::move(w.tasks.back());
+            w.tasks.pop_back();
+        } else {
+            task = std::move(w.tasks.front());
+            w.tasks.pop_front();
+            workers[self]->stolen.fetch_add(1, memory_order_relaxed);
+        }
+        found = true;
+    }
+    if (found && queued.fetch_sub(1) == backlog) {
+        lock_guard guard(lock);
+        room.notify_all();
+    }
+    return found;
+}
+
+void Scheduler::run(unsigned self) {
+    current_pool   = this;
+    current_worker = self;
+    Worker& me     = *workers[self];
+    Task    task;
+    while (true) {
+        if (take(self, task)) {
+            task();
+            task = nullptr; // frees what it holds before the next one
+            me.ran.fetch_add(1, memory_order_relaxed);
+            if (unfinished.fetch_sub(1) == 1) {
+                lock_guard guard(lock);
+                idle.notify_all();
+            }
+            continue;
+        }
+
+        unique_lock guard(lock);
+        me.asleep_since.store(now_ns(), memory_order_relaxed);
+        sleepers.fetch_add(1);
+        work.wait(guard, [&] { return stopping || queued.load() > 0; });
+        sleepers.fetch_sub(1);
+        me.idle_ns.fetch_add(now_ns() - me.asleep_since.exchange(0, memory_order_relaxed), memory_order_relaxed);
+        if (stopping) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+// A work-stealing pool of threads for jobs of very uneven size.
+//
+// A job over many files mixes a few large files, split into chunk tasks,
+// with thousands of small files of one task each. Handing each thread a
+// fixed share of them leaves threads idle while one works through the
+// large file; here every worker has a deque of its own, and a worker that
+// runs out of tasks steals from the others.
+//
+// A task spawned from inside the pool goes onto the back of its worker's
+// deque, and the worker takes from the back, so the chunks it has just
+// split off run while their data is still in its cache. Thieves take from
+// the front, where the oldest tasks are. Tasks submitted from outside the
+// pool are dealt out to the workers in turn, and submit() waits while the
+// pool has backlog tasks waiting, which bounds the memory held by files
+// read ahead of the workers.
+//
+// Each deque has a mutex of its own, so a worker only contends with a thief
+// on its deque, not with the whole pool. Idle workers sleep until a task is
+// queued.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct SchedulerStats {
+    unsigned workers      = 0;
+    uint64_t tasks        = 0; // run to completion
+    uint64_t steals       = 0; // of those, taken from another worker's deque
+    double   idle_seconds = 0; // summed over workers, asleep for lack of tasks
+};
+
+class Scheduler {
+public:
+    using Task = std::function<void()>;
+
+    // Start workers threads; with 0, tasks run on the thread that submits
+    // or spawns them
+    explicit Scheduler(unsigned workers, size_t backlog = 256);
+
+    // Waits for every task, then stops the workers
+    ~Scheduler();
+
+    Scheduler(const Scheduler&)            = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Queue a task from outside the pool, waiting while backlog tasks are
+    // queued and not yet started
+    void submit(Task task);
+
+    // Queue a task from inside a task, on the calling worker's own deque;
+    // never waits. From outside the pool it queues like submit() without
+    // the wait.
+    void spawn(Task task);
+
+    // Wait until every task queued so far, and every task they spawned, has
+    // run
+    void wait();
+
+    [[nodiscard]] SchedulerStats stats() const noexcept;
+
+private:
+    struct Worker; // a deque and the counters of one thread
+
+    void queue(Task task, unsigned worker);
+    bool take(unsigned self, Task& task);
+    void run(unsigned self);
+
+    const size_t                         backlog;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread>             threads;
+    std::atomic<size_t>                  queued {0};     // in a deque, not yet taken
+    std::atomic<size_t>                  unfinished {0}; // queued or running
+    std::atomic<unsigned>                turn {0};       // next worker submit() deals to
+    std::mutex                           lock;           // for the waits below
+    std::condition_variable              work;           // a task was queued, or stop
+    std::condition_variable              room;           // queued fell below backlog
+    std::condition_variable              idle;           // unfinished reached 0
+    std::atomic<unsigned>                sleepers {0};   // waiting on work
+    bool                                 stopping = false;
+};
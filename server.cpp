@@ -0,0 +1,698 @@
+// Lookup server on a Unix domain socket.
+
+#include "server.h"
+
+#include "ini.h"
+#include "lookupcache.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "querylog.h"
+#include "shmring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_map>
+
+using namespace std;
+
+// What every thread that answers lookups keeps to itself
+struct LoopState {
+    explicit LoopState(size_t cache_sets)
+        : cache(cache_sets) { }
+
+    LookupCache cache;
+    QueryLog    log;
+    Histogram   requests; // time to answer what one read or message brought
+};
+
+// Lookup activity summed over threads
+struct Activity {
+    LookupCache::Counters lookups;
+    Histogram::Counts     requests;
+
+    void add(const LoopState& state) noexcept;
+};
+
+// A shared-memory channel and the thread that serves it
+struct SharedClient {
+    ShmChannel   channel;
+    LoopState    state {256};
+    thread       worker;
+    atomic<bool> done {false};
+};
+
+struct SharedClients {
+    explicit SharedClients(const SnapshotHandle& d) noexcept
+        : docs(d) { }
+
+    // Serve the channel in fd from a new thread; takes ownership of fd.
+    // Null if fd does not hold a valid channel.
+    shared_ptr<SharedClient> attach(int fd);
+
+    // Stop and join every channel thread
+    void stop();
+
+    // Activity of every channel, past and present
+    [[nodiscard]] Activity activity();
+
+    const SnapshotHandle&            docs;
+    filesystem::path                 log_path; // query log, if any
+    string                           served;   // file named in logged queries
+    mutex                            lock;
+    vector<shared_ptr<SharedClient>> clients;
+    Activity                         retired; // of channels already joined
+};
+
+void Activity::add(const LoopState& state) noexcept {
+    const LookupCache::Counters c = state.cache.counters();
+    lookups.lookups += c.lookups;
+    lookups.found += c.found;
+    lookups.hits += c.hits;
+    lookups.negative_hits += c.negative_hits;
+    requests += state.requests.counts();
+}
+
+namespace {
+
+constexpr size_t max_request     = 64 * 1024;   // a longer line is an error
+constexpr size_t max_backlog     = 1024 * 1024; // unsent output before reads pause
+constexpr int    accepts_per_run = 16;          // leave the rest to other loops
+constexpr int    events_per_wait = 256;
+
+// Tags for the two descriptors every loop watches besides its clients
+char listener_tag;
+char wake_tag;
+
+struct Connection {
+    int      fd;
+    string   in;             // bytes of an incomplete request
+    string   out;            // responses the socket has not taken yet
+    size_t   sent     = 0;   // how much of out has gone out
+    uint32_t interest = 0;   // events currently registered
+    bool     closing  = false;
+
+    int                      passed_fd = -1; // descriptor that came with the last read
+    shared_ptr<SharedClient> shared;         // channel attached through this connection
+
+    // Responses to the requests of one read, gathered for a single writev.
+    // They point into the document, into string literals and into headers.
+    vector<iovec>                 iov;
+    deque<string>                 headers; // frame headers and stats; a deque so they never move
+    vector<Lookup>                lookups;
+    vector<optional<string_view>> values;
+};
+
+// Look a key up through the thread's cache, and log it if its log is open
+optional<string_view> lookup(const Document* doc, LoopState& state, string_view served, string_view section,
+                             uint64_t section_hash, string_view key, uint64_t key_hash) {
+    if (!state.log.is_open()) {
+        return doc ? state.cache.get(*doc, section, section_hash, key, key_hash) : nullopt;
+    }
+    const auto            start = chrono::steady_clock::now();
+    optional<string_view> value = doc ? state.cache.get(*doc, section, section_hash, key, key_hash) : nullopt;
+    state.log.record(served, section, key, value.has_value(), chrono::steady_clock::now() - start);
+    return value;
+}
+
+// What a loop's requests are answered from
+struct Context {
+    const Document* doc;
+    LoopState&      state;
+    SharedClients&  shared;
+    const Server&   server;
+
+    [[nodiscard]] optional<string_view> get(string_view section, uint64_t section_hash, string_view key,
+                                            uint64_t key_hash) const {
+        return lookup(doc, state, shared.served, section, section_hash, key, key_hash);
+    }
+};
+
+void emit(Connection& c, string_view bytes) {
+    if (!bytes.empty()) {
+        c.iov.push_back(iovec { const_cast<char*>(bytes.data()), bytes.size() });
+    }
+}
+
+string format_stats(const LookupCache::Counters& counters) {
+    uint64_t answered = counters.hits + counters.negative_hits;
+    char     line[160];
+    snprintf(line, sizeof(line), "OK lookups=%llu hits=%llu negative_hits=%llu hit_rate=%.3f\n",
+             static_cast<unsigned long long>(counters.lookups), static_cast<unsigned long long>(counters.hits),
+             static_cast<unsigned long long>(counters.negative_hits),
+             counters.lookups ? static_cast<double>(answered) / static_cast<double>(counters.lookups) : 0.0);
+    return line;
+}
+
+// Answer every complete request in c.in, text lines and binary frames alike
+void handle_requests(Connection& c, const Context& ctx) {
+    string_view pending(c.in);
+    while (!pending.empty()) {
+        if (static_cast<uint8_t>(pending.front()) == frame_magic) {
+            size_t      size   = 0;
+            FrameStatus status = decode_request(pending, c.lookups, size);
+            if (status == FrameStatus::Incomplete) {
+                break;
+            }
+            if (status == FrameStatus::Malformed) {
+                emit(c, "ERR malformed frame\n");
+                c.closing = true;
+                pending   = {};
+                break;
+            }
+
+            c.values.clear();
+            for (const Lookup& l : c.lookups) {
+                c.values.push_back(ctx.get(l.section, l.section_hash, l.key, l.key_hash));
+            }
+            encode_response(c.values, c.headers.emplace_back(), c.iov);
+            pending.remove_prefix(size);
+            continue;
+        }
+
+        size_t nl = pending.find('\n');
+        if (nl == string_view::npos) {
+            break;
+        }
+        string_view line = trim(pending.substr(0, nl));
+        pending.remove_prefix(nl + 1);
+        if (line.empty()) {
+            continue;
+        }
+        if (line == "ATTACH") {
+            if (c.passed_fd < 0 || c.shared) {
+                emit(c, "ERR expected one channel descriptor\n");
+                continue;
+            }
+            c.shared    = ctx.shared.attach(c.passed_fd);
+            c.passed_fd = -1;
+            emit(c, c.shared ? "OK attached\n" : "ERR not a channel\n");
+            continue;
+        }
+        if (line == "STATS") {
+            emit(c, c.headers.emplace_back(format_stats(ctx.server.stats())));
+            continue;
+        }
+        if (line == "METRICS") {
+            emit(c, c.headers.emplace_back(ctx.server.metrics() + "# EOF\n"));
+            continue;
+        }
+
+        string_view section = next_token(line);
+        string_view key     = next_token(line);
+        if (section.empty() || key.empty() || !trim(line).empty()) {
+            emit(c, "ERR expected <section> <key>\n");
+            continue;
+        }
+
+        optional<string_view> value = ctx.get(section, ihash(section), key, ihash(key));
+        if (value) {
+            emit(c, "OK ");
+            emit(c, *value);
+            emit(c, "\n");
+        } else {
+            emit(c, "NOTFOUND\n");
+        }
+    }
+    c.in.erase(0, c.in.size() - pending.size());
+
+    if (!c.in.empty() && static_cast<uint8_t>(c.in.front()) != frame_magic && c.in.size() > max_request) {
+        emit(c, "ERR request too long\n");
+        c.closing = true;
+    }
+}
+
+// Write the gathered responses with one sendmsg, unless older output is
+// still queued; whatever the socket does not take is copied to c.out.
+// False if the peer is gone.
+bool submit(Connection& c) {
+    size_t next = 0;
+    bool   ok   = true;
+    while (c.sent == c.out.size() && next < c.iov.size()) {
+        msghdr msg {};
+        msg.msg_iov    = &c.iov[next];
+        msg.msg_iovlen = min<size_t>(c.iov.size() - next, IOV_MAX);
+        ssize_t n      = ::sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ok = errno == EAGAIN;
+            break;
+        }
+        size_t left = static_cast<size_t>(n);
+        while (next < c.iov.size() && left >= c.iov[next].iov_len) {
+            left -= c.iov[next].iov_len;
+            ++next;
+        }
+        if (left > 0) {
+            c.iov[next].iov_base = static_cast<char*>(c.iov[next].iov_base) + left;
+            c.iov[next].iov_len -= left;
+            break; // the socket is full
+        }
+    }
+    for (; ok && next < c.iov.size(); ++next) {
+        c.out.append(static_cast<const char*>(c.iov[next].iov_base), c.iov[next].iov_len);
+    }
+    c.iov.clear();
+    c.headers.clear();
+    return ok;
+}
+
+// Write as much queued output as the socket takes; false if the peer is
+// gone
+bool flush(Connection& c) {
+    while (c.sent < c.out.size()) {
+        ssize_t n = ::send(c.fd, c.out.data() + c.sent, c.out.size() - c.sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN;
+        }
+        c.sent += static_cast<size_t>(n);
+    }
+    c.out.clear();
+    c.sent = 0;
+    return true;
+}
+
+// Take a descriptor passed with SCM_RIGHTS out of msg, keeping only the
+// latest one
+void take_descriptor(Connection& c, msghdr& msg) {
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if (c.passed_fd >= 0) {
+                ::close(c.passed_fd);
+            }
+            c.passed_fd = fd;
+        }
+    }
+}
+
+// Read everything the socket has and answer it; false once the peer has
+// closed or failed
+bool serve(Connection& c, const Context& ctx) {
+    char buf[64 * 1024];
+    char control[CMSG_SPACE(sizeof(int))];
+    for (;;) {
+        iovec  iov { buf, sizeof(buf) };
+        msghdr msg {};
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t n          = ::recvmsg(c.fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n > 0) {
+            take_descriptor(c, msg);
+            c.in.append(buf, static_cast<size_t>(n));
+            handle_requests(c, ctx);
+            if (!submit(c)) {
+                return false;
+            }
+            if (c.closing || c.out.size() - c.sent >= max_backlog) {
+                return true;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return n < 0 && errno == EAGAIN;
+    }
+}
+
+// Pin the calling thread to the index-th CPU it may run on
+void pin_to_cpu(unsigned index) {
+    cpu_set_t allowed;
+    if (::sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0) {
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            ::pthread_setaffinity_np(::pthread_self(), sizeof(one), &one);
+            return;
+        }
+    }
+}
+
+// Answer a channel's requests until it closes or is interrupted
+void serve_channel(const SnapshotHandle& docs, const string& served, SharedClient& client) {
+    string                        message;
+    vector<Lookup>                lookups;
+    vector<optional<string_view>> values;
+    string                        headers;
+    vector<iovec>                 iov;
+
+    while (client.channel.receive(message)) {
+        size_t size = 0;
+        if (decode_request(message, lookups, size) != FrameStatus::Complete || size != message.size()) {
+            break;
+        }
+
+        const auto start = chrono::steady_clock::now();
+        Snapshot   doc   = docs.read();
+        values.clear();
+        for (const Lookup& l : lookups) {
+            values.push_back(lookup(doc.get(), client.state, served, l.section, l.section_hash, l.key, l.key_hash));
+        }
+        headers.clear();
+        iov.clear();
+        encode_response(values, headers, iov);
+        if (!client.channel.send(iov.data(), iov.size())) {
+            break;
+        }
+        client.state.requests.observe(chrono::steady_clock::now() - start);
+    }
+    client.channel.close();
+    client.state.log.flush();
+    client.done.store(true, memory_order_release);
+}
+
+} // namespace
+
+shared_ptr<SharedClient> SharedClients::attach(int fd) {
+    auto client = make_shared<SharedClient>();
+    if (!client->channel.attach(fd, ShmChannel::Side::Server)) {
+        ::close(fd);
+        return nullptr;
+    }
+    if (!log_path.empty() && !client->state.log.open(log_path)) {
+        return nullptr;
+    }
+
+    lock_guard guard(lock);
+    erase_if(clients, [this](const shared_ptr<SharedClient>& c) {
+        if (!c->done.load(memory_order_acquire)) {
+            return false;
+        }
+        c->worker.join();
+        retired.add(c->state);
+        return true;
+    });
+    client->worker = thread(serve_channel, cref(docs), cref(served), ref(*client));
+    clients.push_back(client);
+    return client;
+}
+
+void SharedClients::stop() {
+    lock_guard guard(lock);
+    for (auto& c : clients) {
+        c->channel.interrupt();
+        c->worker.join();
+        retired.add(c->state);
+    }
+    clients.clear();
+}
+
+Activity SharedClients::activity() {
+    lock_guard guard(lock);
+    Activity   total = retired;
+    for (auto& c : clients) {
+        total.add(c->state);
+    }
+    return total;
+}
+
+Server::Server(const SnapshotHandle& docs)
+    : docs(docs)
+    , shared(make_unique<SharedClients>(docs)) { }
+
+Server::~Server() {
+    stop();
+}
+
+bool Server::listen(const filesystem::path& path) {
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (path.native().size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    path.native().copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    // Only a socket left behind by an earlier server may be replaced; a
+    // mistyped path must not delete a config file
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            errno = EEXIST;
+            return false;
+        }
+        ::unlink(path.c_str());
+    }
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return false;
+    }
+
+    listen_fd   = fd;
+    socket_path = path;
+    return true;
+}
+
+bool Server::start(unsigned count) {
+    if (listen_fd < 0) {
+        errno = EBADF;
+        return false;
+    }
+    if (count == 0) {
+        count = max(1u, thread::hardware_concurrency());
+    }
+
+    state.clear();
+    for (unsigned i = 0; i < count; ++i) {
+        state.push_back(make_unique<LoopState>(1024));
+        if (!shared->log_path.empty() && !state.back()->log.open(shared->log_path)) {
+            return false;
+        }
+    }
+
+    wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        return false;
+    }
+    for (unsigned i = 0; i < count; ++i) {
+        loops.emplace_back(&Server::run, this, i);
+    }
+    return true;
+}
+
+bool Server::log_queries(const filesystem::path& log, const filesystem::path& served) {
+    QueryLog probe;
+    if (!probe.open(log)) {
+        return false;
+    }
+    shared->log_path = log;
+    shared->served   = served.string();
+    return true;
+}
+
+void Server::stop() {
+    if (wake_fd >= 0) {
+        // Never read back, so the eventfd stays readable and wakes every loop
+        uint64_t one = 1;
+        (void)!::write(wake_fd, &one, sizeof(one));
+    }
+    for (thread& t : loops) {
+        t.join();
+    }
+    loops.clear();
+    shared->stop();
+
+    if (wake_fd >= 0) {
+        ::close(wake_fd);
+        wake_fd = -1;
+    }
+    if (listen_fd >= 0) {
+        ::close(listen_fd);
+        listen_fd = -1;
+        ::unlink(socket_path.c_str());
+    }
+}
+
+Activity Server::activity() const {
+    Activity total = shared->activity();
+    for (const auto& s : state) {
+        total.add(*s);
+    }
+    return total;
+}
+
+LookupCache::Counters Server::stats() const {
+    return activity().lookups;
+}
+
+string Server::metrics() const {
+    const Activity                    a      = activity();
+    const LookupCache::Counters&      c      = a.lookups;
+    const SnapshotHandle::ReloadStats reload = docs.reload_stats();
+    Snapshot                          doc    = docs.read();
+
+    string out;
+    write_counter(out, "inireader_lookups_total", "Lookups answered.", c.lookups);
+    write_counter(out, "inireader_lookup_hits_total", "Lookups that found a value.", c.found);
+    write_counter(out, "inireader_lookup_misses_total", "Lookups that found nothing.",
+                  c.lookups - min(c.found, c.lookups));
+    write_counter(out, "inireader_cache_hits_total", "Lookups answered from a hit cache.", c.hits);
+    write_counter(out, "inireader_cache_negative_hits_total", "Lookups answered from a miss cache.", c.negative_hits);
+    write_gauge(out, "inireader_cache_hit_ratio", "Share of all lookups answered from a cache.",
+                c.lookups ? static_cast<double>(c.hits + c.negative_hits) / static_cast<double>(c.lookups) : 0.0);
+    write_histogram(out, "inireader_request_seconds", "Time to answer what one read or channel message brought.",
+                    a.requests);
+    write_counter(out, "inireader_reloads_total", "Successful reloads of the file.", reload.reloads);
+    write_counter(out, "inireader_reload_failures_total", "Reloads that could not read the file.", reload.failures);
+    write_histogram(out, "inireader_parse_seconds", "Time to read and parse the file on a reload.", reload.parse);
+    write_counter(out, "inireader_parsed_bytes_total", "Bytes of INI text read and parsed by reloads.",
+                  reload.parsed_bytes);
+    write_gauge(out, "inireader_document_bytes", "Size of the document being served.",
+                doc ? static_cast<double>(doc->text_bytes()) : 0.0);
+    write_gauge(out, "inireader_resident_bytes", "Resident memory of the process.",
+                static_cast<double>(resident_bytes()));
+    return out;
+}
+
+void Server::run(unsigned index) {
+    pin_to_cpu(index);
+
+    int ep = ::epoll_create1(EPOLL_CLOEXEC);
+    if (ep < 0) {
+        return;
+    }
+
+    epoll_event ev {};
+    ev.events   = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = &listener_tag;
+    ::epoll_ctl(ep, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &wake_tag;
+    ::epoll_ctl(ep, EPOLL_CTL_ADD, wake_fd, &ev);
+
+    unordered_map<Connection*, unique_ptr<Connection>> clients;
+
+    auto close_client = [&](Connection* c) {
+        if (c->shared) {
+            c->shared->channel.interrupt(); // the client's lifeline is gone
+        }
+        if (c->passed_fd >= 0) {
+            ::close(c->passed_fd);
+        }
+        ::close(c->fd); // also drops it from the epoll set
+        clients.erase(c);
+    };
+
+    // Keep the registered events in line with the connection's state:
+    // read while the output backlog is small, wait for writability while
+    // any output is pending
+    auto update_interest = [&](Connection* c) {
+        size_t   backlog = c->out.size() - c->sent;
+        uint32_t want    = (backlog >= max_backlog || c->closing ? 0u : static_cast<uint32_t>(EPOLLIN)) | (backlog > 0 ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+        if (want != c->interest) {
+            epoll_event e {};
+            e.events   = want;
+            e.data.ptr = c;
+            ::epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &e);
+            c->interest = want;
+        }
+    };
+
+    epoll_event events[events_per_wait];
+    for (bool running = true; running;) {
+        int n = ::epoll_wait(ep, events, events_per_wait, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        // One snapshot covers every request answered in this round
+        Snapshot doc = docs.read();
+
+        for (int i = 0; i < n; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == &wake_tag) {
+                running = false;
+                continue;
+            }
+            if (tag == &listener_tag) {
+                for (int a = 0; a < accepts_per_run; ++a) {
+                    int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) {
+                        break;
+                    }
+                    auto c      = make_unique<Connection>();
+                    c->fd       = fd;
+                    c->interest = EPOLLIN;
+                    epoll_event e {};
+                    e.events   = c->interest;
+                    e.data.ptr = c.get();
+                    if (::epoll_ctl(ep, EPOLL_CTL_ADD, fd, &e) != 0) {
+                        ::close(fd);
+                        continue;
+                    }
+                    clients.emplace(c.get(), std::move(c));
+                }
+                continue;
+            }
+
+            auto*    c     = static_cast<Connection*>(tag);
+            uint32_t ready = events[i].events;
+            bool     alive = !(ready & EPOLLERR);
+            if (alive && (ready & EPOLLOUT)) {
+                alive = flush(*c);
+            }
+            if (alive && (ready & (EPOLLIN | EPOLLHUP))) {
+                const auto start = chrono::steady_clock::now();
+                bool       open  = serve(*c, Context { doc.get(), *state[index], *shared, *this });
+                state[index]->requests.observe(chrono::steady_clock::now() - start);
+                alive     = flush(*c) && (open || c->sent < c->out.size());
+                c->closing |= !open;
+            }
+            if (!alive || (c->closing && c->out.empty())) {
+                close_client(c);
+                continue;
+            }
+            update_interest(c);
+        }
+    }
+
+    while (!clients.empty()) {
+        close_client(clients.begin()->first);
+    }
+    state[index]->log.flush();
+    ::close(ep);
+}
@@ -0,0 +1,108 @@
+// Lookup server on a Unix domain socket.
+//
+// The server runs one event loop per core, each a thread with its own
+// epoll set, all serving the documents published through one
+// SnapshotHandle. Every loop watches the shared listening socket with
+// EPOLLEXCLUSIVE, so an incoming connection wakes a single loop, which
+// accepts it and serves it for the rest of its life; connections are
+// sharded across cores without any shared state on the request path.
+// (Linux has no SO_REUSEPORT for Unix sockets, which is why the loops share
+// one listener instead of each binding their own.)
+//
+// The text protocol is line based so it can be driven from a shell:
+//
+//     <section> <key>\n      ->  OK <value>\n  or  NOTFOUND\n
+//
+// Names with blanks go in brackets, as in an edit script. Anything else
+// gets "ERR <reason>\n" back. Programs can send batches of lookups as
+// binary frames instead (see protocol.h); a connection may mix both.
+//
+// Requests may be pipelined: a client can send any number before reading,
+// and responses come back in order. The responses to everything one read
+// brought in go out in a single vectored write, with values referenced in
+// the document rather than copied.
+//
+// Every loop, and every shared-memory channel, answers through a
+// LookupCache of its own (see lookupcache.h), so hot keys and repeated
+// misses are served without touching the document's tables and without
+// any sharing between cores. Publishing a new document invalidates all of
+// them at once. The text request "STATS" reports the combined counters:
+//
+//     STATS\n  ->  OK lookups=<n> hits=<n> negative_hits=<n> hit_rate=<r>\n
+//
+// "METRICS" returns the metrics() of the server in the Prometheus text
+// format, ending with a "# EOF" line. Every thread records into counters
+// and histograms of its own, which are only summed when they are read.
+//
+// With log_queries() every lookup is appended to a query log (see
+// querylog.h), with the time the cache and document took to answer it.
+// Each loop and channel writes its own batches to the log.
+//
+// A client on the same host can also send "ATTACH" with a ShmChannel
+// descriptor attached (see shmring.h); the server then answers that
+// channel's requests from a thread of its own for as long as the client's
+// connection stays open.
+
+#pragma once
+
+#include "lookupcache.h"
+#include "snapshot.h"
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct Activity;
+struct LoopState;
+struct SharedClients;
+
+class Server {
+public:
+    explicit Server(const SnapshotHandle& docs);
+    ~Server();
+
+    Server(const Server&)            = delete;
+    Server& operator=(const Server&) = delete;
+
+    // Bind and listen on the socket at path, replacing a stale socket file;
+    // false on failure, with errno set. Anything at path that is not a
+    // socket is left alone and fails with EEXIST.
+    bool listen(const std::filesystem::path& path);
+
+    // Log every lookup to the query log at log, naming served as the file
+    // looked up; call before start(). False if the log cannot be opened,
+    // with errno set.
+    bool log_queries(const std::filesystem::path& log, const std::filesystem::path& served);
+
+    // Start the event loops, one per core if loops is 0; false on failure,
+    // with errno set. The loops serve until stop().
+    bool start(unsigned loops = 0);
+
+    // Stop the loops, close every connection and remove the socket file
+    void stop();
+
+    // Lookup cache counters summed over every loop and channel; may be
+    // called while the server runs
+    [[nodiscard]] LookupCache::Counters stats() const;
+
+    // Lookups, cache use, request latency, reloads, parse time and memory
+    // in the Prometheus text format (see metrics.h); may be called while
+    // the server runs
+    [[nodiscard]] std::string metrics() const;
+
+private:
+    void run(unsigned index);
+
+    [[nodiscard]] Activity activity() const;
+
+    const SnapshotHandle&                     docs;
+    std::filesystem::path                     socket_path;
+    int                                       listen_fd = -1;
+    int                                       wake_fd   = -1; // eventfd that tells the loops to stop
+    std::vector<std::thread>                  loops;
+    std::vector<std::unique_ptr<LoopState>>   state;  // one per loop
+    std::unique_ptr<SharedClients>            shared; // shared-memory channels and their threads
+};
@@ -0,0 +1,388 @@
+// Shared-memory transport for lookups between processes on one host.
+
+#include "shmring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+constexpr uint64_t channel_magic  = 0x31474e4952494e49ull; // "INIRING1"
+constexpr unsigned max_spin       = 1 << 14;
+constexpr unsigned min_spin       = 16;
+constexpr size_t   length_prefix  = 4;
+constexpr size_t   min_ring_bytes = 4096;
+constexpr size_t   max_ring_bytes = size_t(1) << 30;
+constexpr long     lifeline_ms    = 100; // longest sleep before checking the lifeline
+constexpr int      size_seals     = F_SEAL_SHRINK | F_SEAL_GROW; // a channel's size is fixed
+
+void cpu_relax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// The rings are shared between processes, so these are not the
+// FUTEX_PRIVATE variants. A null timeout waits until woken.
+void futex_wait(atomic<uint32_t>& word, uint32_t expected, const timespec* timeout) noexcept {
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, timeout, nullptr, 0);
+}
+
+void futex_wake(atomic<uint32_t>& word) noexcept {
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+} // namespace
+
+// One direction of the channel. Producer and consumer each write their own
+// cache line; the ring bytes follow the Layout.
+struct ShmChannel::Ring {
+    alignas(64) atomic<uint64_t> head {0}; // bytes ever written, by the producer
+    alignas(64) atomic<uint64_t> tail {0}; // bytes ever read, by the consumer
+    alignas(64) atomic<uint32_t> sleeping {0}; // the consumer may be asleep
+    atomic<uint32_t>             wakeups {0};  // futex word the consumer sleeps on
+};
+
+struct ShmChannel::Layout {
+    uint64_t         magic;
+    uint64_t         ring_bytes;
+    atomic<uint32_t> closed {0};
+    Ring             requests;  // client to server
+    Ring             responses; // server to client
+};
+
+namespace {
+
+// Copy between a ring of capacity bytes and a flat buffer, wrapping at the
+// end of the ring
+void ring_write(char* ring, size_t capacity, uint64_t pos, const char* src, size_t n) noexcept {
+    size_t at    = static_cast<size_t>(pos & (capacity - 1));
+    size_t first = min(n, capacity - at);
+    memcpy(ring + at, src, first);
+    memcpy(ring, src + first, n - first);
+}
+
+void ring_read(const char* ring, size_t capacity, uint64_t pos, char* dst, size_t n) noexcept {
+    size_t at    = static_cast<size_t>(pos & (capacity - 1));
+    size_t first = min(n, capacity - at);
+    memcpy(dst, ring + at, first);
+    memcpy(dst + first, ring, n - first);
+}
+
+} // namespace
+
+ShmChannel::~ShmChannel() {
+    if (shared) {
+        close();
+        ::munmap(shared, length);
+    }
+    if (shm_fd >= 0) {
+        ::close(shm_fd);
+    }
+}
+
+bool ShmChannel::create(size_t ring_bytes) {
+    size_t capacity = min_ring_bytes;
+    while (capacity < ring_bytes && capacity < max_ring_bytes) {
+        capacity *= 2;
+    }
+
+    int fd = ::memfd_create("inireader-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return false;
+    }
+    size_t size = sizeof(Layout) + 2 * capacity;
+    void*  map  = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(size)) == 0 && ::fcntl(fd, F_ADD_SEALS, size_seals) == 0) {
+        map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return false;
+    }
+
+    shared             = new (map) Layout;
+    shared->magic      = channel_magic;
+    shared->ring_bytes = capacity;
+    shm_fd             = fd;
+    length             = size;
+    side               = Side::Client;
+    spin_limit         = thread::hardware_concurrency() > 1 ? 1024 : 0;
+    return true;
+}
+
+bool ShmChannel::attach(int fd, Side s) {
+    // Unless its size is sealed, the other process could shrink the file
+    // under the mapping, and the next access would raise SIGBUS here
+    struct stat st;
+    int         seals = ::fcntl(fd, F_GET_SEALS);
+    if (seals < 0 || (seals & size_seals) != size_seals || ::fstat(fd, &st) != 0
+        || static_cast<size_t>(st.st_size) < sizeof(Layout)) {
+        errno = EINVAL;
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void*  map  = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    // The other process could still rewrite the header, so the ring size is
+    // checked here and only ever read again from length
+    auto*    layout   = static_cast<Layout*>(map);
+    uint64_t capacity = layout->ring_bytes;
+    if (layout->magic != channel_magic || capacity < min_ring_bytes || capacity > max_ring_bytes
+        || (capacity & (capacity - 1)) != 0 || size != sizeof(Layout) + 2 * capacity) {
+        ::munmap(map, size);
+        errno = EINVAL;
+        return false;
+    }
+
+    shared     = layout;
+    shm_fd     = fd;
+    length     = size;
+    side       = s;
+    spin_limit = thread::hardware_concurrency() > 1 ? 1024 : 0;
+    return true;
+}
+
+ShmChannel::Ring& ShmChannel::inbound() const noexcept {
+    return side == Side::Server ? shared->requests : shared->responses;
+}
+
+ShmChannel::Ring& ShmChannel::outbound() const noexcept {
+    return side == Side::Server ? shared->responses : shared->requests;
+}
+
+bool ShmChannel::closed() const noexcept {
+    return !shared || shared->closed.load(memory_order_acquire) != 0 || interrupted.load(memory_order_relaxed);
+}
+
+bool ShmChannel::peer_gone() noexcept {
+    if (lifeline < 0) {
+        return false;
+    }
+    pollfd p { lifeline, POLLRDHUP, 0 };
+    if (::poll(&p, 1, 0) == 1 && (p.revents & (POLLRDHUP | POLLHUP | POLLERR)) != 0) {
+        close();
+        return true;
+    }
+    return false;
+}
+
+bool ShmChannel::send(string_view message) {
+    iovec piece { const_cast<char*>(message.data()), message.size() };
+    return send(&piece, 1);
+}
+
+bool ShmChannel::send(const iovec* pieces, size_t count) {
+    if (!shared) {
+        return false;
+    }
+    const size_t capacity = (length - sizeof(Layout)) / 2;
+    size_t       bytes    = 0;
+    for (size_t i = 0; i < count; ++i) {
+        bytes += pieces[i].iov_len;
+    }
+    if (length_prefix + bytes > capacity || bytes > UINT32_MAX) {
+        errno = EMSGSIZE;
+        return false;
+    }
+
+    Ring&    ring = outbound();
+    char*    data = reinterpret_cast<char*>(shared + 1) + (side == Side::Server ? capacity : 0);
+    uint64_t head = ring.head.load(memory_order_relaxed);
+
+    // Requests and responses alternate, so a full ring is rare; yield to
+    // the consumer until there is room
+    while (head + length_prefix + bytes - ring.tail.load(memory_order_acquire) > capacity) {
+        if (closed() || peer_gone()) {
+            return false;
+        }
+        this_thread::yield();
+    }
+
+    uint32_t prefix = static_cast<uint32_t>(bytes);
+    ring_write(data, capacity, head, reinterpret_cast<const char*>(&prefix), length_prefix);
+    uint64_t pos = head + length_prefix;
+    for (size_t i = 0; i < count; ++i) {
+        ring_write(data, capacity, pos, static_cast<const char*>(pieces[i].iov_base), pieces[i].iov_len);
+        pos += pieces[i].iov_len;
+    }
+
+    // Publishing head and checking for a sleeper pair up with the
+    // consumer's announce-then-recheck in receive(); seq_cst on both sides
+    // means at least one of them sees the other
+    ring.head.store(pos, memory_order_seq_cst);
+    if (ring.sleeping.load(memory_order_seq_cst) != 0) {
+        ring.wakeups.fetch_add(1, memory_order_seq_cst);
+        futex_wake(ring.wakeups);
+    }
+    return !closed();
+}
+
+bool ShmChannel::receive(string& message) {
+    if (!shared) {
+        return false;
+    }
+    const size_t capacity = (length - sizeof(Layout)) / 2;
+    Ring&        ring     = inbound();
+    const char*  data     = reinterpret_cast<const char*>(shared + 1) + (side == Side::Server ? 0 : capacity);
+    uint64_t     tail     = ring.tail.load(memory_order_relaxed);
+
+    auto ready = [&] { return ring.head.load(memory_order_acquire) != tail; };
+
+    unsigned spun = 0;
+    while (!ready()) {
+        if (closed()) {
+            return false;
+        }
+        if (spun < spin_limit) {
+            ++spun;
+            cpu_relax();
+            continue;
+        }
+
+        // Announce, then look once more before sleeping. Nothing wakes the
+        // futex if the other process dies, so with a lifeline the sleep is
+        // cut into slices with a look at the socket after each.
+        uint32_t seen = ring.wakeups.load(memory_order_seq_cst);
+        ring.sleeping.store(1, memory_order_seq_cst);
+        if (!ready() && !closed()) {
+            const timespec slice {0, lifeline_ms * 1000000};
+            futex_wait(ring.wakeups, seen, lifeline >= 0 ? &slice : nullptr);
+        }
+        ring.sleeping.store(0, memory_order_relaxed);
+        if (!ready() && peer_gone()) {
+            return false;
+        }
+        spun = spin_limit + 1; // slept: do not count as a spin success
+    }
+
+    // Adapt the budget to how long messages have been taking to arrive
+    if (spin_limit > 0) {
+        if (spun <= spin_limit && spun > spin_limit / 2) {
+            spin_limit = min(max_spin, spin_limit * 2);
+        } else if (spun > spin_limit) {
+            spin_limit = max(min_spin, spin_limit / 2);
+        }
+    }
+
+    // The producer is in another process: never trust what it wrote
+    uint64_t available = ring.head.load(memory_order_acquire) - tail;
+    uint32_t bytes     = 0;
+    if (available < length_prefix || available > capacity) {
+        close();
+        return false;
+    }
+    ring_read(data, capacity, tail, reinterpret_cast<char*>(&bytes), length_prefix);
+    if (bytes > available - length_prefix) {
+        close();
+        return false;
+    }
+    message.resize(bytes);
+    ring_read(data, capacity, tail + length_prefix, message.data(), bytes);
+    ring.tail.store(tail + length_prefix + bytes, memory_order_release);
+    return true;
+}
+
+void ShmChannel::close() noexcept {
+    if (!shared) {
+        return;
+    }
+    shared->closed.store(1, memory_order_seq_cst);
+    for (Ring* ring : {&shared->requests, &shared->responses}) {
+        ring->wakeups.fetch_add(1, memory_order_seq_cst);
+        futex_wake(ring->wakeups);
+    }
+}
+
+void ShmChannel::interrupt() noexcept {
+    interrupted.store(true, memory_order_seq_cst);
+    if (shared) {
+        Ring& ring = inbound();
+        ring.wakeups.fetch_add(1, memory_order_seq_cst);
+        futex_wake(ring.wakeups);
+    }
+}
+
+ShmClient::~ShmClient() {
+    channel.close();
+    if (sock >= 0) {
+        ::close(sock);
+    }
+}
+
+bool ShmClient::connect(const filesystem::path& socket) {
+    sockaddr_un addr {};
+    addr.sun_family = AF_UNIX;
+    if (socket.native().size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    socket.native().copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || ::connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || !channel.create()) {
+        return false;
+    }
+
+    // Hand the mapping over with the ATTACH request
+    char   command[] = "ATTACH\n";
+    iovec  iov { command, sizeof(command) - 1 };
+    char   control[CMSG_SPACE(sizeof(int))] {};
+    msghdr msg {};
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr* cmsg      = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level   = SOL_SOCKET;
+    cmsg->cmsg_type    = SCM_RIGHTS;
+    cmsg->cmsg_len     = CMSG_LEN(sizeof(int));
+    int fd             = channel.fd();
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+    if (::sendmsg(sock, &msg, MSG_NOSIGNAL) != static_cast<ssize_t>(iov.iov_len)) {
+        return false;
+    }
+
+    string reply;
+    char   c;
+    while (::read(sock, &c, 1) == 1 && c != '\n') {
+        reply += c;
+    }
+    if (reply != "OK attached") {
+        errno = ECONNREFUSED;
+        return false;
+    }
+    channel.watch(sock);
+    return true;
+}
+
+bool ShmClient::lookup(const vector<Lookup>& lookups, vector<optional<string_view>>& values) {
+    request.clear();
+    encode_request(lookups, request);
+    size_t size = 0;
+    return channel.send(request) && channel.receive(response)
+           && decode_response(response, values, size) == FrameStatus::Complete && values.size() == lookups.size();
+}
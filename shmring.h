@@ -0,0 +1,120 @@
+// Shared-memory transport for lookups between processes on one host.
+//
+// A ShmChannel is one shared mapping holding two single-producer,
+// single-consumer byte rings: requests from the client, responses from the
+// server. Messages are the binary frames of protocol.h, each prefixed with
+// its length. Sending is a copy into the ring and a release store; nothing
+// enters the kernel unless the other side is asleep.
+//
+// A receiver waits by spinning first and then sleeping on a futex in the
+// mapping. The spin budget adapts: it grows while messages keep arriving
+// during the spin and shrinks while the receiver ends up sleeping anyway,
+// and it is zero on a single CPU, where spinning only delays the sender.
+// A sender wakes the receiver only if it announced that it is going to
+// sleep.
+//
+// Clients get a channel from a running server (see server.h) with
+// ShmClient, which creates the mapping, seals its size and hands it over
+// the server's Unix socket. The socket stays open as the channel's lifeline: the server's
+// event loop closes the channel when the client's end goes away, and a
+// client waiting for a response checks the socket between futex waits of
+// at most 100 ms, so it sees the channel closed when the server dies.
+
+#pragma once
+
+#include "protocol.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/uio.h>
+#include <vector>
+
+class ShmChannel {
+public:
+    enum class Side { Client, Server };
+
+    ShmChannel() = default;
+    ~ShmChannel();
+
+    ShmChannel(const ShmChannel&)            = delete;
+    ShmChannel& operator=(const ShmChannel&) = delete;
+
+    // Create a new anonymous channel with rings of ring_bytes each (rounded
+    // up to a power of two); false on failure, with errno set
+    bool create(size_t ring_bytes = 1 << 20);
+
+    // Map a channel created by another process; false if fd does not hold
+    // a valid channel, or one whose size is not sealed
+    bool attach(int fd, Side side);
+
+    // Descriptor of the mapping, to pass to the other process
+    [[nodiscard]] int fd() const noexcept { return shm_fd; }
+
+    // Treat a hang-up on socket, which stays owned by the caller, as the
+    // other side closing the channel; checked while waiting in send() and
+    // receive()
+    void watch(int socket) noexcept { lifeline = socket; }
+
+    // Queue one message made of pieces for the other side; false if the
+    // channel is closed or the message can never fit
+    bool send(const iovec* pieces, size_t count);
+    bool send(std::string_view message);
+
+    // Wait for the next message from the other side; false once the channel
+    // is closed or interrupt() was called
+    bool receive(std::string& message);
+
+    // Close the channel for both sides and wake whoever is waiting
+    void close() noexcept;
+
+    // Wake this side's receive() and make it return false
+    void interrupt() noexcept;
+
+    [[nodiscard]] bool closed() const noexcept;
+
+private:
+    struct Ring;
+    struct Layout;
+
+    [[nodiscard]] Ring& inbound() const noexcept;
+    [[nodiscard]] Ring& outbound() const noexcept;
+
+    // True, after closing the channel, if the lifeline has hung up
+    bool peer_gone() noexcept;
+
+    Layout*           shared     = nullptr;
+    size_t            length     = 0;
+    int               shm_fd     = -1;
+    Side              side       = Side::Client;
+    unsigned          spin_limit = 0;  // spins before sleeping in receive()
+    int               lifeline   = -1; // socket watched by peer_gone()
+    std::atomic<bool> interrupted {false};
+};
+
+// Client end of a channel to a lookup server
+class ShmClient {
+public:
+    ShmClient() = default;
+    ~ShmClient();
+
+    ShmClient(const ShmClient&)            = delete;
+    ShmClient& operator=(const ShmClient&) = delete;
+
+    // Connect to the server listening at socket and set up a channel; false
+    // on failure, with errno set
+    bool connect(const std::filesystem::path& socket);
+
+    // Look up a batch of names; the results are views into an internal
+    // buffer, valid until the next call. False if the channel is gone.
+    bool lookup(const std::vector<Lookup>& lookups, std::vector<std::optional<std::string_view>>& values);
+
+private:
+    ShmChannel  channel;
+    int         sock = -1;
+    std::string request;
+    std::string response;
+};
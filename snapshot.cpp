@@ -0,0 +1,163 @@
+// Hot-reloadable, lock-free handle to a parsed Document.
+
+#include "snapshot.h"
+
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// Each reader thread owns one slot, on its own cache line, where it
+// announces the epoch it entered at. Slots are never freed; a thread that
+// exits hands its slot back for the next new thread to reuse.
+struct alignas(64) ReaderSlot {
+    atomic<uint64_t> epoch {0}; // 0 while outside any snapshot
+    atomic<bool>     used {false};
+    ReaderSlot*      next = nullptr;
+};
+
+atomic<uint64_t>    global_epoch {1};
+atomic<ReaderSlot*> readers {nullptr};
+
+struct ThreadReader {
+    ReaderSlot* slot  = nullptr;
+    unsigned    depth = 0;
+
+    ~ThreadReader() {
+        if (slot) {
+            slot->used.store(false, memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadReader this_reader;
+
+// Claim a free slot, or push a new one onto the registry. Runs once per
+// thread and is lock-free like the rest of the read side.
+ReaderSlot* acquire_slot() {
+    for (ReaderSlot* s = readers.load(memory_order_acquire); s; s = s->next) {
+        bool expected = false;
+        if (!s->used.load(memory_order_relaxed)
+            && s->used.compare_exchange_strong(expected, true, memory_order_acquire)) {
+            return s;
+        }
+    }
+
+    auto* s = new ReaderSlot;
+    s->used.store(true, memory_order_relaxed);
+    s->next = readers.load(memory_order_relaxed);
+    while (!readers.compare_exchange_weak(s->next, s, memory_order_release, memory_order_relaxed)) { }
+    return s;
+}
+
+// The announcement must be ordered before the pointer load that follows it,
+// and the publisher's exchange before its epoch bump, hence seq_cst. A
+// reader that announces too late for the publisher to see will then load
+// the new pointer.
+void enter() noexcept {
+    ThreadReader& r = this_reader;
+    if (r.depth++ == 0) {
+        if (!r.slot) {
+            r.slot = acquire_slot();
+        }
+        r.slot->epoch.store(global_epoch.load(memory_order_seq_cst), memory_order_seq_cst);
+    }
+}
+
+void leave() noexcept {
+    ThreadReader& r = this_reader;
+    if (--r.depth == 0) {
+        r.slot->epoch.store(0, memory_order_release);
+    }
+}
+
+// Oldest epoch any reader is inside right now, or UINT64_MAX if none
+uint64_t oldest_reader() noexcept {
+    uint64_t oldest = UINT64_MAX;
+    for (ReaderSlot* s = readers.load(memory_order_acquire); s; s = s->next) {
+        uint64_t e = s->epoch.load(memory_order_seq_cst);
+        if (e != 0 && e < oldest) {
+            oldest = e;
+        }
+    }
+    return oldest;
+}
+
+} // namespace
+
+Snapshot::~Snapshot() {
+    leave();
+}
+
+Snapshot SnapshotHandle::read() const noexcept {
+    enter();
+    return Snapshot(current.load(memory_order_seq_cst));
+}
+
+bool SnapshotHandle::reload(const filesystem::path& path, Merge merge) {
+    lock_guard guard(reloading);
+    const auto start = chrono::steady_clock::now();
+    auto       doc   = make_unique<Document>();
+    if (!doc->load(path, merge)) {
+        failure_count.store(failure_count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        return false;
+    }
+    parse_time.observe(chrono::steady_clock::now() - start);
+    parsed_bytes.store(parsed_bytes.load(memory_order_relaxed) + doc->text_bytes(), memory_order_relaxed);
+    reload_count.store(reload_count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    publish(std::move(doc));
+    return true;
+}
+
+SnapshotHandle::ReloadStats SnapshotHandle::reload_stats() const noexcept {
+    ReloadStats stats;
+    stats.reloads      = reload_count.load(memory_order_relaxed);
+    stats.failures     = failure_count.load(memory_order_relaxed);
+    stats.parsed_bytes = parsed_bytes.load(memory_order_relaxed);
+    stats.parse        = parse_time.counts();
+    return stats;
+}
+
+void SnapshotHandle::publish(unique_ptr<Document> doc) {
+    lock_guard      guard(writer);
+    const Document* old   = current.exchange(doc.release(), memory_order_seq_cst);
+    uint64_t        epoch = global_epoch.fetch_add(1, memory_order_seq_cst) + 1;
+    published.fetch_add(1, memory_order_relaxed);
+    if (old) {
+        retired.emplace_back(old, epoch);
+    }
+    reclaim();
+}
+
+// Free every retired document whose retirement epoch no reader predates.
+// The caller holds the writer lock.
+void SnapshotHandle::reclaim() {
+    if (retired.empty()) {
+        return;
+    }
+    const uint64_t oldest = oldest_reader();
+    erase_if(retired, [oldest](const pair<const Document*, uint64_t>& r) {
+        if (r.second <= oldest) {
+            delete r.first;
+            return true;
+        }
+        return false;
+    });
+}
+
+size_t SnapshotHandle::pending() const {
+    lock_guard guard(writer);
+    return retired.size();
+}
+
+SnapshotHandle::~SnapshotHandle() {
+    lock_guard guard(writer);
+    if (const Document* last = current.exchange(nullptr, memory_order_seq_cst)) {
+        retired.emplace_back(last, global_epoch.fetch_add(1, memory_order_seq_cst) + 1);
+    }
+    while (reclaim(), !retired.empty()) {
+        this_thread::yield();
+    }
+}
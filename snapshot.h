@@ -0,0 +1,99 @@
+// Hot-reloadable, lock-free handle to a parsed Document.
+//
+// Readers take a Snapshot, which pins whatever document is current for as
+// long as the snapshot lives. Taking one is wait-free: a store to a
+// per-thread slot and a pointer load, with no locks and no shared reference
+// count to bounce between cores. A reload parses the new document off to
+// the side, swaps it in with one atomic exchange and retires the old one.
+//
+// Retired documents are reclaimed epoch style, as in userspace RCU: each
+// reader thread announces the epoch it entered at, every publish advances
+// the epoch, and a retired document is freed once no reader is still inside
+// an epoch older than its retirement. Reclamation happens on later publishes
+// and in the destructor, never on the read path.
+
+#pragma once
+
+#include "document.h"
+#include "metrics.h"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+class SnapshotHandle;
+
+// Read-side guard; the document it points at stays alive until it is
+// destroyed. Snapshots may nest but must not move between threads.
+class Snapshot {
+public:
+    ~Snapshot();
+    Snapshot(const Snapshot&)            = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    [[nodiscard]] explicit operator bool() const noexcept { return doc != nullptr; }
+    [[nodiscard]] const Document& operator*() const noexcept { return *doc; }
+    [[nodiscard]] const Document* operator->() const noexcept { return doc; }
+    [[nodiscard]] const Document* get() const noexcept { return doc; }
+
+private:
+    friend class SnapshotHandle;
+    explicit Snapshot(const Document* d) noexcept
+        : doc(d) { }
+
+    const Document* doc;
+};
+
+class SnapshotHandle {
+public:
+    SnapshotHandle() = default;
+    ~SnapshotHandle();
+
+    SnapshotHandle(const SnapshotHandle&)            = delete;
+    SnapshotHandle& operator=(const SnapshotHandle&) = delete;
+
+    // Parse the file at path into a new document and publish it. On failure
+    // the current document stays in place and false is returned. Reloads
+    // run one at a time.
+    bool reload(const std::filesystem::path& path, Merge merge = Merge::None);
+
+    struct ReloadStats {
+        uint64_t          reloads      = 0; // successful ones
+        uint64_t          failures     = 0;
+        uint64_t          parsed_bytes = 0; // text parsed by successful reloads
+        Histogram::Counts parse;            // time to read and parse
+    };
+
+    // What reload() has done so far; may be called from any thread
+    [[nodiscard]] ReloadStats reload_stats() const noexcept;
+
+    // Publish a document built elsewhere
+    void publish(std::unique_ptr<Document> doc);
+
+    // Pin the current document; empty if nothing has been published yet
+    [[nodiscard]] Snapshot read() const noexcept;
+
+    // Number of documents published so far
+    [[nodiscard]] uint64_t generation() const noexcept { return published.load(std::memory_order_relaxed); }
+
+    // Retired documents not yet reclaimed because readers may still see them
+    [[nodiscard]] size_t pending() const;
+
+private:
+    void reclaim();
+
+    std::atomic<const Document*>                      current {nullptr};
+    std::atomic<uint64_t>                             published {0};
+    mutable std::mutex                                writer; // serializes publishers only
+    std::vector<std::pair<const Document*, uint64_t>> retired; // document and retirement epoch
+
+    std::mutex            reloading; // serializes reloads, and so their stats
+    std::atomic<uint64_t> reload_count {0};
+    std::atomic<uint64_t> failure_count {0};
+    std::atomic<uint64_t> parsed_bytes {0};
+    Histogram             parse_time;
+};
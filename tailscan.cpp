@@ -0,0 +1,130 @@
+// Reverse scan from the end of an INI file for last-wins lookups.
+
+#include "tailscan.h"
+
+#include "ini.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+// Read exactly n bytes at off; false with errno set on an error, or on a
+// file that shrank since it was opened
+bool read_block(int fd, char* buf, size_t n, size_t off) {
+    TraceScope trace("read");
+    size_t     got = 0;
+    while (got < n) {
+        ssize_t r = ::pread(fd, buf + got, n - got, static_cast<off_t>(off + got));
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            if (r == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        got += static_cast<size_t>(r);
+    }
+    return true;
+}
+
+} // namespace
+
+TailScanner::~TailScanner() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+bool TailScanner::open(const filesystem::path& path) {
+    TraceScope trace("open");
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+    size = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+// Lines are visited from the last to the first. The first matching entry
+// seen is the latest one in its block; it becomes the answer if the next
+// header above it names the target section, and is dropped if it names any
+// other. Reaching the start of the file with a candidate in hand means the
+// entry sat before any header, which the forward scan ignores too.
+optional<string> TailScanner::find_last(string_view section, string_view key) const {
+    scanned = 0;
+    error   = false;
+    if (fd < 0) {
+        return nullopt;
+    }
+
+    string           window;  // block just read followed by the carried partial line
+    string           pending; // start of a line whose beginning lies in an earlier block
+    optional<string> candidate;
+    Entry            entry;
+    size_t           off = size;
+
+    window.reserve(block);
+    while (off > 0) {
+        TraceScope chunk("chunk");
+        size_t     n = min(block, off);
+        off -= n;
+
+        window.resize(n);
+        if (!read_block(fd, window.data(), n, off)) {
+            error = true;
+            return nullopt;
+        }
+        scanned += n;
+        window += pending;
+
+        size_t end = window.size();
+        while (true) {
+            size_t nl = end == 0 ? string::npos : window.rfind('\n', end - 1);
+            if (nl == string::npos && off > 0) {
+                pending.assign(window, 0, end);
+                break;
+            }
+
+            size_t      begin   = nl == string::npos ? 0 : nl + 1;
+            string_view trimmed = trim(string_view(window).substr(begin, end - begin));
+
+            if (is_header(trimmed)) {
+                if (is_section(trimmed, section)) {
+                    if (candidate) {
+                        return candidate;
+                    }
+                } else {
+                    candidate.reset();
+                }
+            } else if (!candidate && !is_ignorable(trimmed) && parse_section_entry(trimmed, entry)
+                       && entry.valid() && iequals(entry.name(), key)) {
+                candidate.emplace(entry.value());
+            }
+
+            if (nl == string::npos) {
+                break;
+            }
+            end = nl;
+        }
+    }
+
+    return nullopt;
+}
@@ -0,0 +1,50 @@
+// Reverse scan from the end of an INI file for last-wins lookups.
+//
+// Append-only configs put their overrides at the end of the file. Rather
+// than reading the whole file forwards to find the final occurrence of a
+// key, TailScanner reads fixed-size blocks backwards from EOF and stops as
+// soon as it has seen the last matching entry and the header of the section
+// that encloses it. The cost is proportional to the tail behind the match,
+// not to the size of the file.
+//
+// The result is the same as Document with Merge::LastWins.
+
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+
+class TailScanner {
+public:
+    explicit TailScanner(size_t block_size = 64 * 1024)
+        : block(block_size) { }
+    ~TailScanner();
+
+    TailScanner(const TailScanner&)            = delete;
+    TailScanner& operator=(const TailScanner&) = delete;
+
+    // Open a regular file for scanning; returns false if it cannot be opened
+    // or is not seekable (pipes, sockets)
+    bool open(const std::filesystem::path& path);
+
+    // Value of the last occurrence of key in any block of section; nullopt
+    // if there is none, or if a read failed, which failed() tells apart
+    [[nodiscard]] std::optional<std::string> find_last(std::string_view section, std::string_view key) const;
+
+    // True if the last call to find_last() stopped at a read error, with
+    // errno set
+    [[nodiscard]] bool failed() const noexcept { return error; }
+
+    // Bytes read by the last call to find_last()
+    [[nodiscard]] size_t bytes_scanned() const noexcept { return scanned; }
+
+private:
+    size_t         block;
+    int            fd      = -1;
+    size_t         size    = 0;
+    mutable size_t scanned = 0;
+    mutable bool   error   = false;
+};
@@ -0,0 +1,129 @@
+// Timeline tracing in the Chrome trace-event format.
+
+#include "trace.h"
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+struct Event {
+    const char* name;
+    int64_t     begin_ns; // since the trace started
+    int64_t     duration_ns;
+};
+
+struct ThreadEvents {
+    pid_t         tid;
+    string        name;
+    vector<Event> events;
+};
+
+atomic<bool>      enabled {false};
+Clock::time_point origin;
+
+// Buffers are never freed, so the events of threads that have exited are
+// still there to be written
+mutex                            registry_lock;
+vector<unique_ptr<ThreadEvents>> registry;
+
+ThreadEvents& this_thread_events() {
+    thread_local ThreadEvents* events = nullptr;
+    if (!events) {
+        lock_guard guard(registry_lock);
+        events       = registry.emplace_back(make_unique<ThreadEvents>()).get();
+        events->tid  = ::gettid();
+        events->name = events->tid == ::getpid() ? "main" : "thread " + to_string(registry.size() - 1);
+    }
+    return *events;
+}
+
+// JSON string with the characters that need it escaped
+string json_string(string_view text) {
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+void trace_start() {
+    origin = Clock::now();
+    enabled.store(true, memory_order_release);
+}
+
+bool tracing() noexcept {
+    return enabled.load(memory_order_acquire);
+}
+
+void trace_thread_name(const char* name) {
+    this_thread_events().name = name;
+}
+
+bool trace_write(const filesystem::path& path) {
+    ofstream out(path, ios::binary | ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    const pid_t pid = ::getpid();
+    char        buf[256];
+    bool        first = true;
+    out << "{\"traceEvents\":[";
+
+    lock_guard guard(registry_lock);
+    for (const auto& thread : registry) {
+        out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+            << ",\"tid\":" << thread->tid << ",\"args\":{\"name\":" << json_string(thread->name) << "}}";
+        first = false;
+        for (const Event& e : thread->events) {
+            snprintf(buf, sizeof(buf), ",\"cat\":\"inireader\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                     static_cast<double>(e.begin_ns) / 1000.0, static_cast<double>(e.duration_ns) / 1000.0, pid,
+                     thread->tid);
+            out << ",\n{\"name\":" << json_string(e.name) << buf;
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    out.flush();
+    return out.good();
+}
+
+TraceScope::TraceScope(const char* n) noexcept
+    : name(tracing() ? n : nullptr) {
+    if (name) {
+        begin = Clock::now();
+    }
+}
+
+TraceScope::~TraceScope() {
+    if (!name) {
+        return;
+    }
+    const auto end = Clock::now();
+    this_thread_events().events.push_back(Event {
+        name,
+        chrono::duration_cast<chrono::nanoseconds>(begin - origin).count(),
+        chrono::duration_cast<chrono::nanoseconds>(end - begin).count(),
+    });
+}
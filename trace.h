@@ -0,0 +1,47 @@
+// Timeline tracing in the Chrome trace-event format.
+//
+// Phases of the parse and lookup paths are marked with TraceScope. While
+// tracing is off, which is the default, a scope costs one acquire load,
+// which sees the time origin trace_start() sets before it turns tracing on.
+// Once trace_start() has been called every scope records a complete event
+// with its begin time and duration in a buffer of its own thread, and
+// trace_write() saves them all as JSON that chrome://tracing and Perfetto
+// open directly, with one track per thread.
+//
+// The phases recorded are "open", "read" or "mmap" (the mapping itself;
+// its page faults are taken during the scan), "parse" with "scan" and
+// "index" inside it, "chunk" for each block of a reverse scan, "lookup"
+// and "output".
+
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+
+// Start recording events
+void trace_start();
+
+[[nodiscard]] bool tracing() noexcept;
+
+// Name the calling thread's track
+void trace_thread_name(const char* name);
+
+// Write every event recorded so far to path; threads other than the
+// caller must not be recording at the same time. False on failure, with
+// errno set.
+bool trace_write(const std::filesystem::path& path);
+
+// Records the time from construction to destruction as one event; name
+// must be a string literal or otherwise outlive the trace
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) noexcept;
+    ~TraceScope();
+
+    TraceScope(const TraceScope&)            = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char*                           name;
+    std::chrono::steady_clock::time_point begin;
+};
@@ -0,0 +1,217 @@
+// A minimal io_uring ring over the raw system calls.
+
+#include "uring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+unsigned* field(void* map, uint32_t offset) {
+    return reinterpret_cast<unsigned*>(static_cast<char*>(map) + offset);
+}
+
+} // namespace
+
+Uring::~Uring() {
+    if (sqes) {
+        ::munmap(sqes, sqes_len);
+    }
+    if (cq_map && cq_map != sq_map) {
+        ::munmap(cq_map, cq_map_len);
+    }
+    if (sq_map) {
+        ::munmap(sq_map, sq_map_len);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+bool Uring::init(unsigned entries) {
+    if (fd >= 0) {
+        errno = EBUSY;
+        return false;
+    }
+
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring = io_uring_setup(entries, &params);
+    if (ring < 0) {
+        return false;
+    }
+
+    // With IORING_FEAT_SINGLE_MMAP both rings live in one mapping
+    sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_map_len = cq_map_len = max(sq_map_len, cq_map_len);
+    }
+    sq_map = ::mmap(nullptr, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    if (sq_map == MAP_FAILED) {
+        sq_map = nullptr;
+        ::close(ring);
+        return false;
+    }
+    cq_map = sq_map;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq_map = ::mmap(nullptr, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring,
+                        IORING_OFF_CQ_RING);
+        if (cq_map == MAP_FAILED) {
+            cq_map = nullptr;
+            ::close(ring);
+            return false;
+        }
+    }
+    sqes_len  = params.sq_entries * sizeof(io_uring_sqe);
+    void* map = ::mmap(nullptr, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+    if (map == MAP_FAILED) {
+        ::close(ring);
+        return false;
+    }
+    sqes = static_cast<io_uring_sqe*>(map);
+
+    sq_head    = field(sq_map, params.sq_off.head);
+    sq_tail    = field(sq_map, params.sq_off.tail);
+    sq_mask    = field(sq_map, params.sq_off.ring_mask);
+    sq_array   = field(sq_map, params.sq_off.array);
+    cq_head    = field(cq_map, params.cq_off.head);
+    cq_tail    = field(cq_map, params.cq_off.tail);
+    cq_mask    = field(cq_map, params.cq_off.ring_mask);
+    cqes       = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cq_map) + params.cq_off.cqes);
+    sq_entries = params.sq_entries;
+    fd         = ring;
+    return true;
+}
+
+// A cleared entry at the tail of the submission queue, or null if full
+io_uring_sqe* Uring::next_sqe() noexcept {
+    const unsigned tail = *sq_tail;
+    if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+        return nullptr;
+    }
+    const unsigned index = tail & *sq_mask;
+    sq_array[index]      = index;
+    memset(&sqes[index], 0, sizeof(io_uring_sqe));
+    return &sqes[index];
+}
+
+// Publish the entry next_sqe() returned
+void Uring::push() noexcept {
+    __atomic_store_n(sq_tail, *sq_tail + 1, __ATOMIC_RELEASE);
+    ++queued;
+}
+
+unsigned Uring::space() const noexcept {
+    return sq_entries - (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+}
+
+bool Uring::prepare_read(int file, void* buf, unsigned len, uint64_t off, uint64_t user_data) noexcept {
+    io_uring_sqe* sqe = next_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode    = IORING_OP_READ;
+    sqe->fd        = file;
+    sqe->addr      = reinterpret_cast<uint64_t>(buf);
+    sqe->len       = len;
+    sqe->off       = off;
+    sqe->user_data = user_data;
+    push();
+    return true;
+}
+
+bool Uring::prepare_openat(const char* path, int flags, uint64_t user_data) noexcept {
+    io_uring_sqe* sqe = next_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode     = IORING_OP_OPENAT;
+    sqe->fd         = AT_FDCWD;
+    sqe->addr       = reinterpret_cast<uint64_t>(path);
+    sqe->open_flags = static_cast<uint32_t>(flags);
+    sqe->user_data  = user_data;
+    push();
+    return true;
+}
+
+bool Uring::prepare_statx(const char* path, unsigned mask, struct statx* out, uint64_t user_data) noexcept {
+    io_uring_sqe* sqe = next_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode    = IORING_OP_STATX;
+    sqe->fd        = AT_FDCWD;
+    sqe->addr      = reinterpret_cast<uint64_t>(path);
+    sqe->len       = mask;
+    sqe->off       = reinterpret_cast<uint64_t>(out);
+    sqe->user_data = user_data;
+    push();
+    return true;
+}
+
+bool Uring::prepare_close(int file, uint64_t user_data) noexcept {
+    io_uring_sqe* sqe = next_sqe();
+    if (!sqe) {
+        return false;
+    }
+    sqe->opcode    = IORING_OP_CLOSE;
+    sqe->fd        = file;
+    sqe->user_data = user_data;
+    push();
+    return true;
+}
+
+bool Uring::submit(unsigned wait_for) noexcept {
+    while (true) {
+        int n = io_uring_enter(fd, queued, wait_for, wait_for ? IORING_ENTER_GETEVENTS : 0);
+        if (n >= 0) {
+            queued -= min(queued, static_cast<unsigned>(n));
+            return true;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+bool Uring::reap(uint64_t& user_data, int& res) noexcept {
+    const unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    const io_uring_cqe& cqe = cqes[head & *cq_mask];
+    user_data               = cqe.user_data;
+    res                     = cqe.res;
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool Uring::withdraw(uint64_t& user_data) noexcept {
+    if (queued == 0) {
+        return false;
+    }
+    // The kernel only reads the tail when entered, so entries past what it
+    // has consumed are still ours
+    const unsigned tail = *sq_tail - 1;
+    user_data           = sqes[tail & *sq_mask].user_data;
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    --queued;
+    return true;
+}
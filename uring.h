@@ -0,0 +1,85 @@
+// A minimal io_uring ring over the raw system calls.
+//
+// Only what the readers need: queue opens, statx calls, reads and closes,
+// submit them, and wait for and reap their completions. There is no
+// dependency on liburing; the ring is set up with io_uring_setup(2),
+// mapped, and driven with io_uring_enter(2).
+//
+// Kernels without io_uring, and containers or sysctls that forbid it, make
+// init() fail with errno set, and callers fall back to plain reads.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct statx;
+
+class Uring {
+public:
+    Uring() = default;
+    ~Uring();
+
+    Uring(const Uring&)            = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // Set up a ring of at least entries submissions; false on failure, with
+    // errno set
+    bool init(unsigned entries);
+
+    [[nodiscard]] bool     valid() const noexcept { return fd >= 0; }
+    [[nodiscard]] unsigned capacity() const noexcept { return sq_entries; }
+
+    // Queue a read of len bytes at off into buf; false if the submission
+    // queue is full. user_data comes back with the completion.
+    bool prepare_read(int file, void* buf, unsigned len, uint64_t off, uint64_t user_data) noexcept;
+
+    // Queue openat(AT_FDCWD, path, flags); res is the new descriptor. path
+    // must stay valid until the completion is reaped.
+    bool prepare_openat(const char* path, int flags, uint64_t user_data) noexcept;
+
+    // Queue statx(AT_FDCWD, path, 0, mask, out); path and out must stay
+    // valid until the completion is reaped
+    bool prepare_statx(const char* path, unsigned mask, struct statx* out, uint64_t user_data) noexcept;
+
+    bool prepare_close(int file, uint64_t user_data) noexcept;
+
+    // Submission slots free for prepare_*()
+    [[nodiscard]] unsigned space() const noexcept;
+
+    // Submit everything queued and wait until at least wait_for completions
+    // are available; false on failure, with errno set
+    bool submit(unsigned wait_for) noexcept;
+
+    // Take one completion: res is the byte count or a negated errno. False
+    // if there is none.
+    bool reap(uint64_t& user_data, int& res) noexcept;
+
+    // Take back the last submission prepared and not yet submitted, giving
+    // its user_data; false if there is none
+    bool withdraw(uint64_t& user_data) noexcept;
+
+private:
+    io_uring_sqe* next_sqe() noexcept;
+    void          push() noexcept;
+
+    int           fd         = -1;
+    unsigned      sq_entries = 0;
+    unsigned      queued     = 0; // prepared but not yet submitted
+    void*         sq_map     = nullptr;
+    size_t        sq_map_len = 0;
+    void*         cq_map     = nullptr;
+    size_t        cq_map_len = 0;
+    io_uring_sqe* sqes       = nullptr;
+    size_t        sqes_len   = 0;
+    unsigned*     sq_head    = nullptr;
+    unsigned*     sq_tail    = nullptr;
+    unsigned*     sq_mask    = nullptr;
+    unsigned*     sq_array   = nullptr;
+    unsigned*     cq_head    = nullptr;
+    unsigned*     cq_tail    = nullptr;
+    unsigned*     cq_mask    = nullptr;
+    io_uring_cqe* cqes       = nullptr;
+};